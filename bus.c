@@ -10,8 +10,49 @@
 	#include "dev/button-sensor.h"
 #endif
 
+/**
+ * @brief Holds the data message. For now holds a char array.
+ * 
+ */
+struct dtn_msg_data {
+	char data[10];
+};
+
 MEMB(data_stream, struct dtn_msg_data, 1);
 
+/**
+ * @brief Interval of the scripted readings. Set in seconds from the Makefile (make TRAFFIC=5) for a simulation run,
+ *        the button is then not used. On the native target there is no button to press.
+ */
+#ifdef BUS_CONF_READING_INTERVAL
+#define BUS_READING_INTERVAL (BUS_CONF_READING_INTERVAL * CLOCK_SECOND)
+#elif CONTIKI_TARGET_NATIVE
+#define BUS_READING_INTERVAL 10*CLOCK_SECOND
+#endif
+/**
+ * @brief Interval of the statistics report. Set in seconds from the Makefile. The STATS lines are collected 
+ *        from the log of every node to get the delivery ratio, the frames per delivered message and the queue occupancy.
+ */
+#ifdef BUS_CONF_REPORT_INTERVAL
+#define BUS_REPORT_INTERVAL (BUS_CONF_REPORT_INTERVAL * CLOCK_SECOND)
+#endif
+/**
+ * @brief Address of the destination of the readings.
+ */
+#ifdef BUS_CONF_DESTINATION
+#define BUS_DESTINATION BUS_CONF_DESTINATION
+#else
+#define BUS_DESTINATION 0x04
+#endif
+/**
+ * @brief Nodes taking scripted readings. Nodes 1 to BUS_SOURCES, so the relays of a simulation only carry.
+ */
+#ifdef BUS_CONF_SOURCES
+#define BUS_SOURCES BUS_CONF_SOURCES
+#else
+#define BUS_SOURCES 0xFF
+#endif
+
 #if CONTIKI_TARGET_ORISENPRIME
 	#define FLASH_LED(l) {		\
 		leds_on(l); 			\
@@ -36,6 +77,50 @@ set_local_address(){
 	rimeaddr_copy(&rimeaddr_node_addr, &myAddr);
 }
 
+/**
+ * @brief Called when a message is delivered
+ * @details Called when a message is delivered
+ * 
+ * @param esender The End Sender of the message.
+ * @param data The message.
+ * @param len Length of the message.
+ */
+static void
+recv_msg(const rimeaddr_t *esender, const uint8_t *data, uint16_t len){
+	printf("MESSAGE FROM: %d LEN: %d DATA: %.*s \n", esender->u8[0], len, len, (const char*) data);
+}
+
+/**
+ * @brief Called when a message sent is delivered
+ * @details Called when a message sent is delivered
+ * 
+ * @param epacketid The ID of the message.
+ */
+static void
+delivered_msg(uint16_t epacketid){
+	printf("MESSAGE DELIVERED: %u \n", epacketid);
+}
+
+static const struct dtn_callbacks dtn_call = {recv_msg, delivered_msg};
+
+#ifdef BUS_REPORT_INTERVAL
+/**
+ * @brief Print the statistics report.
+ * @details Print the statistics report. One line per node. Nothing is printed if the statistics are compiled out.
+ */
+static void
+report_stats(){
+	const struct dtn_stats *s = dtn_stats();
+
+	if(s == NULL){
+		return;
+	}
+	printf("STATS: NODE: %d QUEUE: %d SPRAYS: %u REQUESTS: %u HANDOFFS: %u DELIVERED: %u OWN DELIVERED: %u \n", 
+		rimeaddr_node_addr.u8[0], dtn_q_size(), s->sprays_sent, s->requests_sent, s->handoffs_sent, 
+		s->delivered, s->delivered_own);
+}
+#endif
+
 /**
  * @brief Destruct Stuff
  * @details Destruct Stuff
@@ -58,6 +143,12 @@ PROCESS_THREAD(bus_transport, ev, data){
 	PROCESS_EXITHANDLER(destructor());
 
 	static rimeaddr_t addr_ereceviver;
+#ifdef BUS_READING_INTERVAL
+	static struct etimer reading_timer;
+#endif
+#ifdef BUS_REPORT_INTERVAL
+	static struct etimer report_timer;
+#endif
 	
 	memb_init(&data_stream);
 
@@ -74,21 +165,48 @@ PROCESS_THREAD(bus_transport, ev, data){
 #if CONTIKI_TARGET_ORISENPRIME
 	set_power(0x01);
 #endif
-	dtn_init();
+	dtn_init(&dtn_call);
+#ifdef BUS_READING_INTERVAL
+	etimer_set(&reading_timer, BUS_READING_INTERVAL);
+#endif
+#ifdef BUS_REPORT_INTERVAL
+	etimer_set(&report_timer, BUS_REPORT_INTERVAL);
+#endif
 
 	while(1){
 
-		PROCESS_WAIT_EVENT_UNTIL(ev   == sensors_event &&
-			     data == &button_sensor);
+		PROCESS_WAIT_EVENT();
+#ifdef BUS_REPORT_INTERVAL
+		if(ev == PROCESS_EVENT_TIMER && data == &report_timer){
+			report_stats();
+			etimer_reset(&report_timer);
+			continue;
+		}
+#endif
+#ifdef BUS_READING_INTERVAL
+		//Scripted! A reading every interval drives the protocol
+		if(ev != PROCESS_EVENT_TIMER || data != &reading_timer){
+			continue;
+		}
+		etimer_reset(&reading_timer);
+		if(rimeaddr_node_addr.u8[0] > BUS_SOURCES || rimeaddr_node_addr.u8[0] == BUS_DESTINATION){
+			continue;
+		}
+		printf("READING: NODE: %d \n", rimeaddr_node_addr.u8[0]);
+#else
+		if(ev != sensors_event || data != &button_sensor){
+			continue;
+		}
+#endif
 
 #if CONTIKI_TARGET_ORISENPRIME
 		FLASH_LED(LEDS_BLUE);
 #endif
 
 		rimeaddr_copy(&addr_ereceviver, &rimeaddr_null);
-		addr_ereceviver.u8[0] = 0x04;
-		//Create new buffer
-		dtn_new_buff(myData, &addr_ereceviver);
+		addr_ereceviver.u8[0] = BUS_DESTINATION;
+		//Add reading. Readings close together share one bundle
+		dtn_append(myData->data, sizeof(myData->data), &addr_ereceviver, DTN_CLASS_TELEMETRY);
 	}
 
 	PROCESS_END();
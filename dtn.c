@@ -8,8 +8,51 @@
 #include "contiki.h"
 #include "dtn.h"
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
-#include <math.h>
+#include "lib/list.h"
+#include "lib/memb.h"
+#include "lib/random.h"
+#if DTN_FLASH_STORE == 1 || DTN_EPOCH_STORE == 1
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+#endif
+#if DTN_ENERGEST == 1
+#include "sys/energest.h"
+#endif
+
+#if DTN_STATS == 1
+static struct dtn_stats dtn_stat;
+#define DTN_STAT(field) (dtn_stat.field++)
+#define DTN_STAT_ADD(field, value) (dtn_stat.field += (value))
+#else
+#define DTN_STAT(field)
+#define DTN_STAT_ADD(field, value)
+#endif
+
+#if DTN_STATS == 1 && DTN_ENERGEST == 1
+/**
+ * @brief The Energest times at dtn_init().
+ */
+static struct dtn_energy dtn_energy_start;
+//Callbacks are registered through their metered wrapper
+#define DTN_METERED(fn) fn##_metered
+#else
+#define DTN_METERED(fn) fn
+#endif
+
+#if DTN_TRACE == DTN_TRACE_RING
+static struct dtn_trace_record dtn_trace[DTN_TRACE_RECORDS];
+static uint8_t dtn_trace_next;
+static uint8_t dtn_trace_count;
+#if DTN_TRACE_DRAIN == 1
+PROCESS(dtn_trace_process, "DTN Trace");
+static uint8_t dtn_trace_posted;
+#endif
+#endif
+
+//Longest time ahead a deadline can be set, CLOCK_LT() only orders times within half the clock range
+#define DTN_CLOCK_HALF ((clock_time_t) ~(clock_time_t) 0 >> 1)
 
 #define PRINT2ADDR(addr) printf("%02x%02x:%02x%02x",(addr)->u8[3], (addr)->u8[2], (addr)->u8[1], (addr)->u8[0])
 
@@ -21,9 +64,66 @@
  * @param S The MAX the queue can hold
  */
 PACKETQUEUE(pkt_q, MAX_QUEUE_PACKETS);
+PACKETQUEUE(pkt_q_alarm, DTN_CLASS_ALARM_PACKETS);
+PACKETQUEUE(pkt_q_bulk, DTN_CLASS_BULK_PACKETS);
+
+/**
+ * @brief Queue size, number of copies and scheduler weight of every class.
+ */
+static const uint16_t dtn_class_size[DTN_CLASSES] = {DTN_CLASS_ALARM_PACKETS, MAX_QUEUE_PACKETS, DTN_CLASS_BULK_PACKETS};
+static const uint8_t dtn_class_copies[DTN_CLASSES] = {DTN_CLASS_ALARM_COPIES, DTN_L_COPIES, DTN_CLASS_BULK_COPIES};
+static const uint8_t dtn_class_weight[DTN_CLASSES] = {DTN_CLASS_ALARM_WEIGHT, DTN_CLASS_TELEMETRY_WEIGHT, DTN_CLASS_BULK_WEIGHT};
+
+/**
+ * @brief Holds the bundle index entries. One for every packet the queues can hold.
+ */
+MEMB(dtn_index_memb, struct dtn_index_item, DTN_QUEUED_PACKETS);
+
+/**
+ * @brief Holds the staging slots of requested packets waiting for their handoff.
+ */
+MEMB(dtn_stage_memb, struct dtn_stage, DTN_STAGE_SLOTS);
 
 static struct dtn_channels dtn_chan;
 static struct dtn_vars dtn_global;
+/**
+ * @brief The bundle index buckets. Every bucket is a list of struct dtn_index_item.
+ */
+static void *dtn_index[DTN_INDEX_BUCKETS];
+/**
+ * @brief The tombstone ring. Holds the last DTN_TOMBSTONES packets known to be delivered.
+ */
+static struct dtn_tombstone dtn_tombs[DTN_TOMBSTONES];
+/**
+ * @brief The neighbours recently heard.
+ */
+static struct dtn_contact dtn_contacts[DTN_CONTACTS];
+/**
+ * @brief The fragmented payload being reassembled.
+ */
+static struct dtn_reassembly dtn_reasm;
+/**
+ * @brief The open bundle of dtn_append().
+ */
+static struct dtn_aggregate dtn_agg;
+/**
+ * @brief The run time configuration.
+ */
+static struct dtn_config dtn_conf;
+#if DTN_FLASH_STORE == 1
+/**
+ * @brief Size of a record of the flash log.
+ */
+#define DTN_FLASH_RECORD (sizeof(struct dtn_msg_header) + DTN_FRAG_SIZE)
+/**
+ * @brief The Flash Store index.
+ */
+static struct dtn_flash_entry dtn_flash[DTN_FLASH_BUNDLES];
+#endif
+/**
+ * @brief The staging list. Oldest slot first.
+ */
+static void *dtn_stage_list;
 
 /**
  * @brief  Get the Header structure from the packet queue item passed.
@@ -41,6 +141,54 @@ static struct dtn_msg_header
 	return r_msg_hdr;
 }
 
+/**
+ * @brief Get the class of a queued packet.
+ * @details Get the class of a queued packet from the queue holding it.
+ * 
+ * @param packetqueue_item The queued packet.
+ * @return The class.
+ */
+static uint8_t
+queue_class(struct packetqueue_item *item){
+	uint8_t c;
+
+	for(c = 0; c < DTN_CLASSES - 1 && item->queue != dtn_global.pkt_q[c]; c++);
+	return c;
+}
+
+/**
+ * @brief Get the first queued packet of the first class with packets queued.
+ * @details Get the first queued packet of the first class with packets queued. The classes are 
+ *          gone through in the order of their number, DTN_CLASS_ALARM first.
+ * 
+ * @param tclass The first class to look at.
+ * @return The packet or NULL (0) if the queues are empty.
+ */
+static struct packetqueue_item
+*queue_first(uint8_t tclass){
+	for(; tclass < DTN_CLASSES; tclass++){
+		if(packetqueue_first(dtn_global.pkt_q[tclass]) != NULL){
+			return packetqueue_first(dtn_global.pkt_q[tclass]);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Get the queued packet after a packet.
+ * @details Get the queued packet after a packet. At the end of a queue the first packet of the next class is returned.
+ * 
+ * @param packetqueue_item The queued packet.
+ * @return The next packet or NULL (0) at the end of the last queue.
+ */
+static struct packetqueue_item
+*queue_next(struct packetqueue_item *item){
+	if(item->next != NULL){
+		return item->next;
+	}
+	return queue_first(queue_class(item) + 1);
+}
+
 /**
  * @brief Check if the header is same. Version and same protocol name.
  * @details Check if the header is same. Version and same protocol name.
@@ -52,12 +200,46 @@ is_spray_wait(struct dtn_msg_header *hdr){
 	if(hdr->protocol.version != DTN_VERSION){
 		return 0;
 	}
-	if(hdr->protocol.magic[0] != 'S' || hdr->protocol.magic[1] != 'W'){
+	if(hdr->protocol.type != 'W'){
+		return 0;
+	}
+	if(hdr->data_len > DTN_FRAG_SIZE || hdr->frag_index >= hdr->frag_total || hdr->frag_total > DTN_MAX_FRAGS){
+		return 0;
+	}
+	if(hdr->tclass >= DTN_CLASSES){
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Check if the header is a Batch Spray or an Offer. Version and same protocol name.
+ * @details Check if the header is a Batch Spray or an Offer. Version and same protocol name.
+ * 
+ * @param dtn_batch_header The header to test if correct.
+ */
+static int
+is_batch(struct dtn_batch_header *hdr){
+	if(hdr->protocol.version != DTN_VERSION){
+		return 0;
+	}
+	if(hdr->protocol.type != 'B' && hdr->protocol.type != 'O'){
 		return 0;
 	}
 	return 1;
 }
 
+/**
+ * @brief Check if the buffer holds the header only.
+ * @details Check if the buffer holds the header only. Such a packet is an offer or a request, 
+ *          the data is only sent with the handoff.
+ */
+static int
+is_hdr_only(){
+	struct dtn_msg_header *hdr = (struct dtn_msg_header*) packetbuf_dataptr();
+	return packetbuf_datalen() < sizeof(struct dtn_msg_header) + hdr->data_len;
+}
+
 /*-------------------------------- Debug Functions---------------------------------*/
 
 /**
@@ -71,14 +253,13 @@ print_buf_with_hdr(){
 	}
 
 	struct dtn_msg_header *hdr = (struct  dtn_msg_header*) packetbuf_hdrptr(); 
-	struct dtn_msg_data *data = (struct dtn_msg_data*) packetbuf_dataptr();
 
 	printf("--- !Dump! ----");
 	printf("Msg from: eSender: "); 
 	printf(" - { source: "); 
 	PRINT2ADDR(&hdr->ereceiver); 
 	printf(" id:%d, num_copies:%d } - ", hdr->epacketid, hdr->num_copies);
-	printf("DATA: {NAME: %s} \n", data->data);
+	printf("DATA: {LEN: %d, FRAG: %d/%d} \n", hdr->data_len, hdr->frag_index + 1, hdr->frag_total);
 }
 
 /**
@@ -113,24 +294,16 @@ print_q(){
 	}
 
 	struct packetqueue_item *q_item;
-	int qLength = packetqueue_len(dtn_global.pkt_q);
 	struct dtn_msg_header *tmp_hdr;
-	int i;
 
-	q_item = packetqueue_first(dtn_global.pkt_q);
-	//Loop through queue
-	for(i = 0; i < qLength; i++){
+	//Loop through the queues
+	for(q_item = queue_first(0); q_item != NULL; q_item = queue_next(q_item)){
 		tmp_hdr = get_hdr_buff(q_item);
 		printf("{ ID: %d - Esender: ",tmp_hdr->epacketid);
 		PRINT2ADDR(&tmp_hdr->esender);
 		printf(" - Ereceiver: ");
 		PRINT2ADDR(&tmp_hdr->ereceiver);
-		printf(" NUM COPIES: %d } \n", tmp_hdr->num_copies);	
-
-		//Last One should be NULL
-		if(q_item->next != NULL){
-			q_item = q_item->next;
-		}		
+		printf(" NUM COPIES: %d CLASS: %d } \n", tmp_hdr->num_copies, tmp_hdr->tclass);
 	}
 }
 
@@ -176,46 +349,164 @@ DEBUG_PKT(struct dtn_msg_header *hdr, int priority){
 }
 
 /**
- * @brief Standard debuging function! Used to test code.
- * @details This function is the same for all implementations of the group.
- * 
- * @param dtn_msg_header The header to output.
- * @param func Function Name.
+ * @brief Names of the frames traced. Indexed by DTN_EV_*.
  */
-static void
-print_packetbuf(struct dtn_msg_header *a, char *func)
+static const char *dtn_trace_names[] = {"Spray", "Offer", "request", "handoff"};
+
+void
+dtn_trace_print(const struct dtn_trace_record *rec)
 {
-  printf("%s, ", func);
-  PRINT2ADDR(packetbuf_addr(PACKETBUF_ADDR_SENDER));
+  printf("%s, ", dtn_trace_names[rec->event]);
+  PRINT2ADDR(&rec->sender);
   printf(", ");
-  PRINT2ADDR(packetbuf_addr(PACKETBUF_ADDR_RECEIVER));
-  if (is_spray_wait(a)) {
+  PRINT2ADDR(&rec->receiver);
+  if (rec->is_dtn) {
     printf(", ");
-    PRINT2ADDR(&a->esender);
+    PRINT2ADDR(&rec->esender);
     printf(", ");
-    PRINT2ADDR(&a->ereceiver);
-    printf(", %d, %d\n",a->epacketid, a->num_copies);
+    PRINT2ADDR(&rec->ereceiver);
+    printf(", %d, %d\n",rec->epacketid, rec->num_copies);
   } else {
     printf(", X, X, X, X\n");
   }
 }
+
+int
+dtn_trace_read(struct dtn_trace_record *rec){
+#if DTN_TRACE == DTN_TRACE_RING
+	uint8_t first;
+
+	if(dtn_trace_count == 0){
+		return 0;
+	}
+	first = (dtn_trace_next + DTN_TRACE_RECORDS - dtn_trace_count) % DTN_TRACE_RECORDS;
+	memcpy(rec, &dtn_trace[first], sizeof(struct dtn_trace_record));
+	dtn_trace_count--;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * @brief Standard debuging function! Used to test code.
+ * @details This function is the same for all implementations of the group. The frame is traced by the 
+ *          DTN_TRACE backend. The ring only takes a copy of the addresses so the radio path is not blocked by printf.
+ * 
+ * @param dtn_msg_header The header to output.
+ * @param event The frame sent. One of DTN_EV_*.
+ */
+static void
+print_packetbuf(struct dtn_msg_header *a, uint8_t event)
+{
+#if DTN_TRACE != DTN_TRACE_OFF
+#if DTN_TRACE == DTN_TRACE_RING
+	struct dtn_trace_record *rec = &dtn_trace[dtn_trace_next];
+	dtn_trace_next = (dtn_trace_next + 1) % DTN_TRACE_RECORDS;
+	if(dtn_trace_count < DTN_TRACE_RECORDS){
+		dtn_trace_count++;
+	}
+#else
+	struct dtn_trace_record trace_rec;
+	struct dtn_trace_record *rec = &trace_rec;
+#endif
+
+	rec->event = event;
+	rec->time = clock_time();
+	rimeaddr_copy(&rec->sender, packetbuf_addr(PACKETBUF_ADDR_SENDER));
+	rimeaddr_copy(&rec->receiver, packetbuf_addr(PACKETBUF_ADDR_RECEIVER));
+	rec->is_dtn = is_spray_wait(a);
+	if(rec->is_dtn){
+		rimeaddr_copy(&rec->esender, &a->esender);
+		rimeaddr_copy(&rec->ereceiver, &a->ereceiver);
+		rec->epacketid = a->epacketid;
+		rec->num_copies = a->num_copies;
+	}
+
+#if DTN_TRACE == DTN_TRACE_TEXT
+	dtn_trace_print(rec);
+#elif DTN_TRACE_DRAIN == 1
+	//One event until the ring is drained, so a burst of frames does not fill the event queue
+	if(dtn_trace_posted == 0 && process_post(&dtn_trace_process, PROCESS_EVENT_CONTINUE, NULL) == PROCESS_ERR_OK){
+		dtn_trace_posted = 1;
+	}
+#endif
+#endif
+}
+
+#if DTN_TRACE == DTN_TRACE_RING && DTN_TRACE_DRAIN == 1
+/**
+ * @brief Prints the trace ring every time a record is added.
+ * @details Prints the trace ring every time a record is added. print_packetbuf() posts a PROCESS_EVENT_CONTINUE,
+ *          the ring is read from the process so the printing is kept out of the radio path.
+ */
+PROCESS_THREAD(dtn_trace_process, ev, data){
+	static struct dtn_trace_record rec;
+	PROCESS_BEGIN();
+
+	while(1){
+		PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_CONTINUE);
+		dtn_trace_posted = 0;
+		while(dtn_trace_read(&rec) == 1){
+			dtn_trace_print(&rec);
+		}
+	}
+
+	PROCESS_END();
+}
+#endif
 /*------------------------------------- Workings ---------------------------------*/
+/**
+ * @brief LOG2(1 + i/16) in sixteenths. The fraction part of dtn_log2().
+ */
+static const uint8_t dtn_log2_frac[16] = {0, 1, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 15};
+
+/**
+ * @brief Integer LOG2 in sixteenths.
+ * @details Integer LOG2 in sixteenths. The integer part is the position of the highest bit set, 
+ *          the fraction is looked up from the 4 bits after it. Folded by the compiler for a constant value.
+ * 
+ * @param value The value. Must not be 0.
+ * @return 16*LOG2(value), rounded.
+ */
+static uint16_t
+dtn_log2(uint16_t value){
+	uint8_t bits = 0;
+
+	while((value >> bits) > 1){
+		bits++;
+	}
+	//4 bits after the highest one
+	if(bits >= 4){
+		return (bits << 4) + dtn_log2_frac[(value >> (bits - 4)) & 0x0F];
+	}
+	return (bits << 4) + dtn_log2_frac[(value << (4 - bits)) & 0x0F];
+}
+
 /**
  * @brief Calculate the maximum lifetime of a packet in the queue.
- * @details Calculate the maximum lifetime of a packet in the queue.
- *          2*LOG2(L_COPIES)*REBROADCAST_INTERVAL
+ * @details Calculate the maximum lifetime of a packet in the queue, as given by DTN_LIFETIME_MODEL.
+ *          DTN_LIFETIME_LOG gives 2*LOG2(L_COPIES)*REBROADCAST_INTERVAL, where the interval is a round of the queue.
+ *          A packet waiting for its End Receiver (L of 1) gets the lifetime of L 2, never a lifetime of 0.
+ * 
+ * @param num_copies Number of copies of the packet.
+ * @return The lifetime.
  */
-/*static int
+static clock_time_t
 calculate_max_lifetime(uint16_t num_copies){
-	int delay = 2*( log(num_copies) / log(2) )*( (dtn_q_size()*DTN_PACKET_DELAY) + DTN_QUEUE_DELAY);
-	printf("Delay: %d \n", delay);
-	return delay;
-}*/
+	uint32_t delay;
 
-/** REPLACES THE FUNCTION ABOVE! SO NO NEED TO LINK MATH LIBRARY!! **/
-static int
-calculate_max_lifetime(uint16_t num_copies){
-	return DTN_MAX_LIFETIME;
+	if(DTN_LIFETIME_MODEL == DTN_LIFETIME_FIXED){
+		return dtn_conf.max_lifetime;
+	}
+	if(num_copies < 2){
+		num_copies = 2;
+	}
+	delay = 2 * (uint32_t) dtn_log2(num_copies) * ((dtn_q_size() * (uint32_t) dtn_conf.packet_delay) + dtn_conf.queue_delay) / 16;
+	if(delay > DTN_LIFETIME_CAP){
+		return DTN_LIFETIME_CAP;
+	}
+	return (clock_time_t) delay;
 }
 
 /**
@@ -227,7 +518,7 @@ calculate_max_lifetime(uint16_t num_copies){
  */
 static int
 ceiling_divider(uint16_t value, int divider){
-	if(value % 2){
+	if(value % divider){
 		//Save Ceiling
 		return  1 + ((value - 1) / divider);
 	}
@@ -235,200 +526,180 @@ ceiling_divider(uint16_t value, int divider){
 }
 
 
-/**
- * @brief Load header structure into header location.
- * @details Load header structure into header location.
- * 
- * @param dtn_msg_header Header to Load.
- */
-static void
-load_buf_hdr(struct dtn_msg_header *hdr){
-	packetbuf_hdralloc(sizeof(struct dtn_msg_header));
-	memcpy(packetbuf_hdrptr(), hdr, sizeof(struct dtn_msg_header));
-}
-
 /**
  * @brief Create a new header structure.
- * @details Create a new header structure.
+ * @details Create a new header structure. The header is allocated in the header location of the buffer
+ *          and filled in place.
  * 
  * @param destination The End destination.
+ * @param data_len Length of the data in the buffer.
+ * @param frag_index Position of the fragment in the payload.
+ * @param frag_total Number of fragments of the payload.
+ * @param tclass The traffic class.
  */
 static void
-create_buf_hdr(const rimeaddr_t *destination){
-	struct dtn_msg_header hdr;
-
-	hdr.protocol.version = DTN_VERSION;
-	hdr.protocol.magic[0] = 'S';
-	hdr.protocol.magic[1] = 'W';
-	hdr.num_copies = DTN_L_COPIES;
-
-	rimeaddr_copy(&hdr.esender, &rimeaddr_node_addr);
-	rimeaddr_copy(&hdr.ereceiver, destination);
-	hdr.epacketid = dtn_global.pkt_seq_no;
+create_buf_hdr(const rimeaddr_t *destination, uint8_t data_len, uint8_t frag_index, uint8_t frag_total, uint8_t tclass){
+	struct dtn_msg_header *hdr;
 
-	//Load header into buffer
-	load_buf_hdr(&hdr);
+	//Header location of the buffer
+	packetbuf_hdralloc(sizeof(struct dtn_msg_header));
+	hdr = (struct dtn_msg_header*) packetbuf_hdrptr();
+
+	hdr->protocol.version = DTN_VERSION;
+	hdr->protocol.type = 'W';
+	hdr->num_copies = dtn_conf.copies[tclass];
+
+	rimeaddr_copy(&hdr->esender, &rimeaddr_node_addr);
+	rimeaddr_copy(&hdr->ereceiver, destination);
+	hdr->epacketid = ((uint16_t) dtn_global.epoch << DTN_ID_SEQ_BITS) | dtn_global.pkt_seq_no;
+	hdr->data_len = data_len;
+	hdr->frag_index = frag_index;
+	hdr->frag_total = frag_total;
+	hdr->age = 0;
+	hdr->ttl = DTN_BUNDLE_TTL;
+	hdr->tclass = tclass;
 
 	//Increment Sequence Number
-	dtn_global.pkt_seq_no += 1;
+	dtn_global.pkt_seq_no = (dtn_global.pkt_seq_no + 1) & DTN_ID_SEQ_MASK;
 }
 
 /**
  * @brief Create data section in packet.
- * @details Create data section in packet.
+ * @details Create data section in packet. The copy clears the buffer first.
  * 
- * @param dtn_msg_data The data passed by the user.
+ * @param data The data passed by the user.
+ * @param len Length of the data.
  */
 static void
-create_buf_data(struct dtn_msg_data *data){
-	packetbuf_clear();
-	packetbuf_copyfrom(&data->data, sizeof(data->data));
+create_buf_data(const uint8_t *data, uint8_t len){
+	packetbuf_copyfrom(data, len);
 }
 
 /**
- * @brief Save buffer item in queue.
- * @details Save buffer item in queue. If the packet has just received set number of copies to 0. 
- *          Since no hand off has been given. 0 shows that no runicast has been received.
+ * @brief Get the bucket of the bundle index where a packet is kept.
+ * @details Get the bucket of the bundle index where a packet is kept. The packet id is
+ *          incremented for every new packet so its lower bits spread the packets of one sender.
  * 
- * @param isReceived If the packet has just been received set to 1 (True) if from queue set to 0 (False)
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @return The list holding the bucket.
  */
-void
-queue_buf(int isReceived){
-	int *p;
-	//Received
-	struct dtn_msg_header *hdr = (struct dtn_msg_header*) packetbuf_dataptr();	
-	int delay = DTN_TIMEOUT_UNCONFIRMED;
+static list_t
+index_bucket(uint16_t pkt_id, const rimeaddr_t *esender){
+	uint16_t b = (pkt_id ^ esender->u8[0] ^ (esender->u8[1] << 3)) & (DTN_INDEX_BUCKETS - 1);
+	return (list_t) &dtn_index[b];
+}
 
-	if(isReceived == 1){
-		//update number of copies to 0. No Runic yeath!
-		hdr->num_copies = 0;
-	} else {
-		delay = calculate_max_lifetime(hdr->num_copies);
+/**
+ * @brief Add a packet to the bundle index.
+ * @details Add a packet to the bundle index. The entry is filled from the header passed, 
+ *          the packet queue item is linked once the packet is queued.
+ * 
+ * @param dtn_msg_header Header of the packet to index.
+ * @return Pointer to the new entry or NULL if there is no free entry.
+ */
+static struct dtn_index_item
+*index_add(struct dtn_msg_header *hdr){
+	struct dtn_index_item *entry = memb_alloc(&dtn_index_memb);
+	if(entry == NULL){
+		return NULL;
 	}
 
-	//Enqueue Received Buffer
-	packetqueue_enqueue_packetbuf(dtn_global.pkt_q, delay, p);
-	//Clear Buffer
-	packetbuf_clear();
+	entry->item = NULL;
+	entry->next_expiry = NULL;
+	entry->queued = clock_time();
+	rimeaddr_copy(&entry->esender, &hdr->esender);
+	rimeaddr_copy(&entry->ereceiver, &hdr->ereceiver);
+	entry->epacketid = hdr->epacketid;
+	list_add(index_bucket(entry->epacketid, &entry->esender), entry);
+	return entry;
 }
 
 /**
- * @brief Load the packet item into the buffer.
- * @details Load the packet item into the buffer. If loading packet for Broadcast check that number of copies is not 0.
+ * @brief Search the bundle index for the packet with same epacketid and esender.
+ * @details Search the bundle index for the packet with same epacketid and esender. 
+ *          Only the bucket for epacketid and esender is visited.
  * 
- * @param packetqueue_item The packet queue item needed to be loaded in the buffer.
- * @param is_bcast If loading packet for a broadcast set to 1 (True) else 0 (False).
- * @return integer if 0 (False) if 1 (True)
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @return Index entry or NULL (0) if not found.
  */
-static int
-load_pkt_item(struct packetqueue_item *item, uint8_t is_bcast){
-	struct queuebuf *q_buf;
-	struct dtn_msg_header *hdr;
-
-	//Get Queue buffer from packetqueue_item
-	q_buf = packetqueue_queuebuf(item);
+static struct dtn_index_item
+*index_find(uint16_t pkt_id, const rimeaddr_t *esender){
+	struct dtn_index_item *entry;
 
-	//If bcast check that L != 0
-	if(is_bcast == 1){
-		hdr = (struct dtn_msg_header*) queuebuf_dataptr(q_buf);
-		if(hdr->num_copies == 0){
-			return 0;
+	for(entry = list_head(index_bucket(pkt_id, esender)); entry != NULL; entry = entry->next){
+		if(entry->epacketid == pkt_id && rimeaddr_cmp(&entry->esender, esender) == 1){
+			return entry;
 		}
 	}
-	//Convert buff to header
-	queuebuf_to_packetbuf(q_buf);
-	return 1;
+	return NULL;
 }
 
 /**
- * @brief Remove data from buffer.
- * @details Remove data from buffer.
+ * @brief Remove entry from the bundle index.
+ * @details Remove entry from the bundle index and release it.
+ * 
+ * @param dtn_index_item The entry to remove.
  */
 static void
-remove_data_from_buf(){
-	struct dtn_msg_header *hdr;
-	struct dtn_msg_header *hdr_cpy;
-	//Read data ptr
-	hdr = (struct dtn_msg_header*) packetbuf_dataptr();
-	hdr_cpy = hdr;
-	//Clear Buffer
-	packetbuf_clear();
-	//Copy in buffer
-	packetbuf_copyfrom(hdr_cpy, sizeof(struct dtn_msg_header));
+index_remove(struct dtn_index_item *entry){
+	list_remove(index_bucket(entry->epacketid, &entry->esender), entry);
+	memb_free(&dtn_index_memb, entry);
 }
 
 /**
- * @brief Load header only to buffer.
- * @details Load header only to buffer.
+ * @brief Remove entry from the expiry list.
+ * @details Remove entry from the expiry list. The expiry timer is left as is, 
+ *          if it fires with nothing to expire it is set again.
  * 
- * @param packetqueue_item The packet queue item to load.
- * @param isHalved Should the numb_copies be halved? if 1(True) half if 0 (False) leave as is.
+ * @param dtn_index_item The entry to remove.
  */
 static void
-load_hdr_item(struct packetqueue_item *item, int isHalved){
-	struct queuebuf *q_buf;
-	struct dtn_msg_header *hdr;
-	struct dtn_msg_header cpy_hdr;
+expiry_remove(struct dtn_index_item *entry){
+	struct dtn_index_item **e;
 
-	//Get buffer
-	q_buf = packetqueue_queuebuf(item);
-	//Convert buff to header
-	hdr = (struct dtn_msg_header*) queuebuf_dataptr(q_buf);
-	//Copy so if alteration made it is not comitted in good memory
-	memcpy(&cpy_hdr, hdr, sizeof(struct dtn_msg_header));
-	//Half value. Sending with runicast
-	if(isHalved == 1 && hdr->num_copies >= 2){
-		cpy_hdr.num_copies = ceiling_divider(cpy_hdr.num_copies, 2);
+	for(e = &dtn_global.expiry_list; *e != NULL; e = &(*e)->next_expiry){
+		if(*e == entry){
+			*e = entry->next_expiry;
+			entry->next_expiry = NULL;
+			return;
+		}
 	}
-	//Add Header in data buffer
-	packetbuf_copyfrom(&cpy_hdr, sizeof(struct dtn_msg_header));
 }
 
 /**
-* Parse through queue and broadcast
-*/
-/**
- * @brief Search in queue and find packet with same epacketid, esender and ereceiver.
- * @details Search in queue and find packet with same epacketid, esender and ereceiver. 
+ * @brief Keep the contact sessions on their packet when the queue changes.
+ * @details Keep the contact sessions on their packet when the queue changes. A session keeps its place as a 
+ *          position in the queues, so a packet added or removed before it moves the position by one. Otherwise the
+ *          packet after a removed one is skipped, or the one before an added one is looked at twice.
  * 
- * @param pkt_id The packet id
- * @param esender The End Sender Address
- * @param ereceiver The End Receiver Address
- * @return Packet Queue Pointer or NULL (0) if not found.
+ * @param item The packet added or about to be removed. Still in its queue.
+ * @param is_added 1 (True) if the packet was added, 0 (False) if it is removed.
  */
-static struct packetqueue_item
-*find_packet(uint16_t pkt_id, const rimeaddr_t *esender, const rimeaddr_t *ereceiver){
-	int i = 0;
-	int qLength = packetqueue_len(dtn_global.pkt_q);
+static void
+session_moved(struct packetqueue_item *item, uint8_t is_added){
 	struct packetqueue_item *q_item;
-	struct dtn_msg_header *tmp_hdr;
-	
-	//Queue is empty!!
-	if(qLength == 0){
-		return NULL;
+	uint16_t pos = 0;
+	int i;
+
+	for(i = 0; i < DTN_HANDOFF_SLOTS && dtn_chan.rc[i].session == 0; i++);
+	if(DTN_CONTACT_SESSION == 0 || i == DTN_HANDOFF_SLOTS){
+		return;
 	}
-	
-	q_item = packetqueue_first(dtn_global.pkt_q);
-	//Loop through queue
-	for(i = 0; i < qLength; i++){
-		tmp_hdr = get_hdr_buff(q_item);
-		if(tmp_hdr->epacketid == pkt_id &&
-				rimeaddr_cmp(&tmp_hdr->esender, esender) == 1 &&
-				rimeaddr_cmp(&tmp_hdr->ereceiver, ereceiver) == 1){
-			return q_item;
+	for(q_item = queue_first(0); q_item != NULL && q_item != item; q_item = queue_next(q_item)){
+		pos++;
+	}
+	for(i = 0; i < DTN_HANDOFF_SLOTS; i++){
+		if(dtn_chan.rc[i].session == 1 && pos < dtn_chan.rc[i].next_pos){
+			dtn_chan.rc[i].next_pos = (is_added == 1) ? dtn_chan.rc[i].next_pos + 1 : dtn_chan.rc[i].next_pos - 1;
 		}
-
-		//Last One should be NULL
-		if(q_item->next != NULL){
-			q_item = q_item->next;
-		}		
 	}
-	return NULL;
 }
 
 /**
  * @brief Remove queued packet.
- * @details Remove queue packet. Copied from packetqueue.c
+ * @details Remove queue packet. Copied from packetqueue.c. The index entry of the packet is removed as well.
  * 
  * @param item packetqueue_item to delete from queue.
  */
@@ -437,94 +708,1933 @@ dtn_remove_queued_packet(void *item) {
   struct packetqueue_item *i = item;
   struct packetqueue *q = i->queue;
 
+  //Broadcast continues from the start of the queue
+  if(dtn_global.pkt_last_sent[queue_class(i)] == i){
+    dtn_global.pkt_last_sent[queue_class(i)] = NULL;
+  }
+  session_moved(i, 0);
+  expiry_remove(packetqueue_ptr(i));
+  index_remove(packetqueue_ptr(i));
   list_remove(*q->list, i);
   queuebuf_free(i->buf);
-  ctimer_stop(&i->lifetimer);
   memb_free(q->memb, i);
 }
 
 /**
- * @brief Handle queue broadcast. Timer are set according to need.
- * @details Handle queue broadcast. A message is sent in interval set in DTN_PACKET_DELAY,
- *          this helps reduce traffic in channel making it more probable to receive a runicast.
- *          After all the queue is broadcasted a delay of DTN_QUEUE_DELAY is introduced to 
- *          reduce traffic on the channel. The function also checks that the number of copies is larger
- *          equak to 1. 
+ * @brief Get the age of a queued packet.
+ * @details Get the age of a queued packet. The age it had when received plus the time since it was queued, 
+ *          rounded to the closest second. Set in every copy of the packet that is sent.
  * 
- * @param p_item Not used! The packet item sent is stored in the global variable.
+ * @param packetqueue_item The queued packet.
+ * @return The age in seconds.
+ */
+static uint16_t
+bundle_age(struct packetqueue_item *item){
+	struct dtn_index_item *entry = packetqueue_ptr(item);
+	clock_time_t held = clock_time() - entry->queued;
+
+	return get_hdr_buff(item)->age + (uint16_t)((held + CLOCK_SECOND / 2) / CLOCK_SECOND);
+}
+
+#if DTN_FLASH_STORE == 1
+/**
+ * @brief Write an entry of the Flash Store index to flash.
+ * @details Write an entry of the Flash Store index to flash.
+ * 
+ * @param i The entry.
  */
 static void
-broadcast_next(void *p_item){ 
-	static struct packetqueue_item *next_item;
-	struct dtn_msg_header *msg_hdr;
-	//If queue is empty nothing to bcast
-	if(dtn_q_size(dtn_global) <= 0){
-		ctimer_set(&dtn_global.local_ctimer, DTN_QUEUE_DELAY, broadcast_next, &dtn_global.pkt_last_sent);
-		return;
-	}
+flash_write_entry(uint8_t i){
+	int fd = cfs_open(DTN_FLASH_INDEX, CFS_READ | CFS_WRITE);
 
-	//If packet has not benn sent yeath or end of queue
-	if(dtn_global.pkt_last_sent == NULL || dtn_global.pkt_last_sent->next == NULL){
-		next_item = packetqueue_first(dtn_global.pkt_q);
-	} else {
-		next_item = dtn_global.pkt_last_sent->next;
-	}
-	
-	msg_hdr = get_hdr_buff(next_item);
-	//Check L value if 0 do not send!!!
-	if(msg_hdr->num_copies < 1){
-		//Immediately go to next calll
-		ctimer_set(&dtn_global.local_ctimer, DTN_PACKET_DELAY, broadcast_next, &dtn_global.pkt_last_sent);
+	if(fd < 0){
 		return;
 	}
+	cfs_seek(fd, (cfs_offset_t) i * sizeof(struct dtn_flash_entry), CFS_SEEK_SET);
+	cfs_write(fd, &dtn_flash[i], sizeof(struct dtn_flash_entry));
+	cfs_close(fd);
+}
 
-	//Store Next Item
-	dtn_global.pkt_last_sent = next_item;
-	//Load packet in buffer
-	if(load_pkt_item(next_item, 1) == 0){
-		//Immediately go to next calll
-		ctimer_set(&dtn_global.local_ctimer, DTN_PACKET_DELAY, broadcast_next, &dtn_global.pkt_last_sent);
-		return;
-	}
-	//send broadcast
-	print_packetbuf(packetbuf_dataptr(), "Spray");
+/**
+ * @brief Find a packet in the Flash Store.
+ * @details Find a packet in the Flash Store. Only the index in RAM is searched.
+ * 
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @return The record holding the packet or -1 if not found.
+ */
+static int
+flash_find(uint16_t pkt_id, const rimeaddr_t *esender){
+	int i;
+
+	for(i = 0; i < DTN_FLASH_BUNDLES; i++){
+		if(dtn_flash[i].in_use == 1 && dtn_flash[i].epacketid == pkt_id && rimeaddr_cmp(&dtn_flash[i].esender, esender) == 1){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Free a record of the Flash Store.
+ * @details Free a record of the Flash Store. Only the index is written, the log record is overwritten when used again.
+ * 
+ * @param i The record.
+ */
+static void
+flash_remove(uint8_t i){
+	dtn_flash[i].in_use = 0;
+	flash_write_entry(i);
+}
+
+/**
+ * @brief Number of free records in the Flash Store.
+ */
+static uint8_t
+flash_free_count(){
+	uint8_t i;
+	uint8_t count = 0;
+
+	for(i = 0; i < DTN_FLASH_BUNDLES; i++){
+		count += (dtn_flash[i].in_use == 0);
+	}
+	return count;
+}
+
+/**
+ * @brief Move a queued packet to the Flash Store.
+ * @details Move a queued packet to the Flash Store. The packet is written in the next free record of the log 
+ *          and its index entry after it. The packet stays in the queue, it is removed by the caller.
+ * 
+ * @param packetqueue_item The queued packet.
+ * @return 1 (True) if written, 0 (False) if the store is full or could not be written.
+ */
+static int
+flash_spill(struct packetqueue_item *item){
+	struct queuebuf *q_buf = packetqueue_queuebuf(item);
+	struct dtn_msg_header *hdr = (struct dtn_msg_header*) queuebuf_dataptr(q_buf);
+	uint16_t len = queuebuf_datalen(q_buf);
+	uint8_t i;
+	int fd;
+	int written;
+
+	//Records are used in turn so writes are spread on the log
+	for(i = 0; i < DTN_FLASH_BUNDLES && dtn_flash[(dtn_global.flash_next + i) % DTN_FLASH_BUNDLES].in_use == 1; i++);
+	if(i == DTN_FLASH_BUNDLES || len > DTN_FLASH_RECORD){
+		return 0;
+	}
+	i = (dtn_global.flash_next + i) % DTN_FLASH_BUNDLES;
+
+	fd = cfs_open(DTN_FLASH_LOG, CFS_READ | CFS_WRITE);
+	if(fd < 0){
+		return 0;
+	}
+	cfs_seek(fd, (cfs_offset_t) i * DTN_FLASH_RECORD, CFS_SEEK_SET);
+	//Packet leaves the queue. Save the age it has now
+	hdr->age = bundle_age(item);
+	written = cfs_write(fd, hdr, len);
+	cfs_close(fd);
+	if(written != len){
+		return 0;
+	}
+
+	dtn_flash[i].in_use = 1;
+	dtn_flash[i].len = len;
+	rimeaddr_copy(&dtn_flash[i].esender, &hdr->esender);
+	dtn_flash[i].epacketid = hdr->epacketid;
+	dtn_flash[i].tclass = hdr->tclass;
+	flash_write_entry(i);
+	dtn_global.flash_next = (i + 1) % DTN_FLASH_BUNDLES;
+	return 1;
+}
+
+/**
+ * @brief Recover the Flash Store.
+ * @details Recover the Flash Store. The index is read back from flash, the packets are paged in lazily.
+ *          If there is no index the files are created.
+ */
+static void
+flash_recover(){
+	int fd = cfs_open(DTN_FLASH_INDEX, CFS_READ);
+	int len = 0;
+	uint8_t i;
+
+	memset(dtn_flash, 0, sizeof(dtn_flash));
+	if(fd >= 0){
+		len = cfs_read(fd, dtn_flash, sizeof(dtn_flash));
+		cfs_close(fd);
+	}
+	//First boot! Create the store
+	if(len <= 0){
+		cfs_coffee_reserve(DTN_FLASH_LOG, (cfs_offset_t) DTN_FLASH_BUNDLES * DTN_FLASH_RECORD);
+		cfs_coffee_reserve(DTN_FLASH_INDEX, sizeof(dtn_flash));
+		memset(dtn_flash, 0, sizeof(dtn_flash));
+		fd = cfs_open(DTN_FLASH_INDEX, CFS_READ | CFS_WRITE);
+		if(fd >= 0){
+			cfs_write(fd, dtn_flash, sizeof(dtn_flash));
+			cfs_close(fd);
+		}
+		return;
+	}
+
+	for(i = 0; i < DTN_FLASH_BUNDLES; i++){
+		if(dtn_flash[i].in_use != 1){
+			dtn_flash[i].in_use = 0;
+			continue;
+		}
+		DEBUG_MSG(2, "PACKET RECOVERED FROM FLASH! ESENDER: ", &dtn_flash[i].esender);
+	}
+}
+#endif
+#if DTN_EPOCH_STORE == 1
+/**
+ * @brief Start a new boot epoch.
+ * @details Start a new boot epoch. The epoch is read from flash, incremented and written back.
+ *          The IDs of this boot can not collide with the IDs of the packets sent before the restart.
+ * @return The epoch of this boot.
+ */
+static uint8_t
+flash_next_epoch(){
+	int fd = cfs_open(DTN_FLASH_EPOCH, CFS_READ);
+	uint8_t epoch = 0;
+
+	if(fd >= 0){
+		if(cfs_read(fd, &epoch, sizeof(epoch)) != sizeof(epoch)){
+			epoch = 0;
+		}
+		cfs_close(fd);
+	}
+	epoch += 1;
+	fd = cfs_open(DTN_FLASH_EPOCH, CFS_WRITE);
+	if(fd >= 0){
+		cfs_write(fd, &epoch, sizeof(epoch));
+		cfs_close(fd);
+	}
+	return epoch;
+}
+#endif
+
+/**
+ * @brief Move to the next epoch.
+ * @details Move to the next epoch. Called when the sequence number wraps, so the IDs of the node go round all 
+ *          the epochs before one is given again. Kept in flash with DTN_EPOCH_STORE.
+ */
+static void
+epoch_advance(){
+#if DTN_EPOCH_STORE == 1
+	dtn_global.epoch = flash_next_epoch() & (0xFFFF >> DTN_ID_SEQ_BITS);
+#else
+	dtn_global.epoch = (dtn_global.epoch + 1) & (0xFFFF >> DTN_ID_SEQ_BITS);
+#endif
+}
+
+/**
+ * @brief Set the expiry timer to the earliest lifetime.
+ * @details Set the expiry timer to the earliest lifetime. Stopped if no packet is queued.
+ */
+static void
+expiry_set_timer();
+
+/**
+ * @brief Callback of the expiry timer. Remove all packets whose lifetime ended.
+ * @details Callback of the expiry timer. Remove all packets whose lifetime ended. The list is sorted so
+ *          only the packets at its start are visited.
+ * 
+ * @param ptr Not used!
+ */
+static void
+expire_packets(void *ptr){
+	clock_time_t now = clock_time();
+
+	while(dtn_global.expiry_list != NULL && !CLOCK_LT(now, dtn_global.expiry_list->deadline)){
+#if DTN_FLASH_STORE == 1
+		//Long lived! Copies left are kept in flash for the next contact. Not if the end to end lifetime is over
+		if(get_hdr_buff(dtn_global.expiry_list->item)->num_copies > 1 && 
+				bundle_age(dtn_global.expiry_list->item) < get_hdr_buff(dtn_global.expiry_list->item)->ttl &&
+				flash_spill(dtn_global.expiry_list->item) == 1){
+			DEBUG_MSG(3, "PACKET EXPIRED! MOVED TO FLASH. ESENDER: ", &dtn_global.expiry_list->esender);
+			dtn_remove_queued_packet(dtn_global.expiry_list->item);
+			continue;
+		}
+#endif
+		DEBUG_MSG(3, "PACKET EXPIRED! ESENDER: ", &dtn_global.expiry_list->esender);
+		DTN_STAT(expired);
+		dtn_remove_queued_packet(dtn_global.expiry_list->item);
+	}
+	expiry_set_timer();
+}
+
+static void
+expiry_set_timer(){
+	clock_time_t now = clock_time();
+	struct dtn_index_item *first = dtn_global.expiry_list;
+
+	if(first == NULL){
+		ctimer_stop(&dtn_global.expiry_ctimer);
+		return;
+	}
+	//Already due
+	if(!CLOCK_LT(now, first->deadline)){
+		ctimer_set(&dtn_global.expiry_ctimer, 0, expire_packets, NULL);
+		return;
+	}
+	ctimer_set(&dtn_global.expiry_ctimer, first->deadline - now, expire_packets, NULL);
+}
+
+/**
+ * @brief Set the lifetime of a queued packet.
+ * @details Set the lifetime of a queued packet. The only place where a lifetime is started or extended.
+ *          It never goes past the end to end lifetime (ttl) left to the packet. The entry is moved to its position in the sorted expiry list and if it is now the first
+ *          the expiry timer is set again. NB: The list is walked to find the position, so the cost is O(n) in the 
+ *          packets queued. One timer serves the whole queue but the inserts do not scale, fine for the queues of a mote.
+ * 
+ * @param item packetqueue_item of the packet.
+ * @param lifetime The lifetime from now.
+ */
+static void
+set_lifetime(struct packetqueue_item *item, clock_time_t lifetime){
+	struct dtn_index_item *entry = packetqueue_ptr(item);
+	struct dtn_msg_header *hdr = get_hdr_buff(item);
+	struct dtn_index_item **e;
+	clock_time_t held = clock_time() - entry->queued;
+	uint32_t left = (hdr->ttl > hdr->age) ? (uint32_t)(hdr->ttl - hdr->age) * CLOCK_SECOND : 0;
+
+	//End to end lifetime left caps the lifetime in this queue
+	left = (left > held) ? left - held : 0;
+	if(lifetime > left){
+		lifetime = (clock_time_t) left;
+	}
+
+	expiry_remove(entry);
+	entry->deadline = clock_time() + lifetime;
+
+	for(e = &dtn_global.expiry_list; *e != NULL; e = &(*e)->next_expiry){
+		if(CLOCK_LT(entry->deadline, (*e)->deadline)){
+			break;
+		}
+	}
+	entry->next_expiry = *e;
+	*e = entry;
+
+	if(dtn_global.expiry_list == entry){
+		expiry_set_timer();
+	}
+}
+
+/**
+ * @brief Score of a queued packet for the Eviction Policy.
+ * @details Score of a queued packet for the Eviction Policy. The packet with the highest score is evicted.
+ * 
+ * @param dtn_index_item The index entry of the packet.
+ * @param now The current clock time.
+ * @return The score.
+ */
+static uint32_t
+evict_score(struct dtn_index_item *entry, clock_time_t now){
+	uint16_t num_copies = get_hdr_buff(entry->item)->num_copies;
+	clock_time_t age = now - entry->queued;
+	uint32_t score;
+
+	switch(DTN_EVICT_POLICY){
+	case DTN_EVICT_FEWEST_COPIES:
+		//Copies first, the age only breaks ties. Clamped so a 32 bit clock does not overwrite the copies
+		score = age;
+		return ((uint32_t)(0xFFFF - num_copies) << 16) | ((score > 0xFFFF) ? 0xFFFF : score);
+	case DTN_EVICT_WEIGHTED:
+		score = (uint32_t)(age / CLOCK_SECOND) * DTN_EVICT_W_AGE;
+		if(num_copies < dtn_conf.copies[DTN_CLASS_TELEMETRY]){
+			score += (uint32_t)(dtn_conf.copies[DTN_CLASS_TELEMETRY] - num_copies) * DTN_EVICT_W_COPIES;
+		}
+		return score;
+	default:
+		return age;
+	}
+}
+
+/**
+ * @brief Find the packet the Eviction Policy would evict.
+ * @details Find the packet the Eviction Policy would evict. Locally created packets 
+ *          are skipped if DTN_EVICT_PROTECT_LOCAL is set, unless the new packet is local as well.
+ * 
+ * @param tclass The class of the new packet. Only a packet of the same class is evicted.
+ * @param is_local If the new packet is created locally set to 1 (True) else 0 (False).
+ * @return Index entry of the packet or NULL (0) if none can be evicted.
+ */
+static struct dtn_index_item
+*evict_candidate(uint8_t tclass, uint8_t is_local){
+	struct packetqueue_item *q_item;
+	struct dtn_index_item *entry;
+	struct dtn_index_item *evict = NULL;
+	clock_time_t now = clock_time();
+	uint32_t score;
+	uint32_t evict_score_max = 0;
+
+	if(DTN_EVICT_POLICY == DTN_EVICT_NONE){
+		return NULL;
+	}
+
+	for(q_item = packetqueue_first(dtn_global.pkt_q[tclass]); q_item != NULL; q_item = q_item->next){
+		entry = packetqueue_ptr(q_item);
+		if(DTN_EVICT_PROTECT_LOCAL == 1 && is_local == 0 && 
+				rimeaddr_cmp(&entry->esender, &rimeaddr_node_addr) == 1){
+			continue;
+		}
+		score = evict_score(entry, now);
+		if(evict == NULL || score > evict_score_max){
+			evict = entry;
+			evict_score_max = score;
+		}
+	}
+	return evict;
+}
+
+/**
+ * @brief Make room in a full queue.
+ * @details Make room in a full queue by evicting the packet chosen by the Eviction Policy.
+ * 
+ * @param tclass The class of the new packet.
+ * @param is_local If the new packet is created locally set to 1 (True) else 0 (False).
+ * @return 1 (True) if there is room in the queue, 0 (False) if not.
+ */
+static int
+make_room(uint8_t tclass, uint8_t is_local){
+	struct dtn_index_item *entry;
+
+	if(packetqueue_len(dtn_global.pkt_q[tclass]) < dtn_class_size[tclass]){
+		return 1;
+	}
+	entry = evict_candidate(tclass, is_local);
+#if DTN_FLASH_STORE == 1
+	//Overflow! The packet is moved to flash instead of lost. The oldest if no policy is used
+	if(entry == NULL){
+		entry = packetqueue_ptr(packetqueue_first(dtn_global.pkt_q[tclass]));
+	}
+	if(flash_spill(entry->item) == 1){
+		DEBUG_MSG(2, "QUEUE FULL!! MOVED PACKET TO FLASH FROM: ", &entry->esender);
+		dtn_remove_queued_packet(entry->item);
+		return 1;
+	}
+	entry = evict_candidate(tclass, is_local);
+#endif
+	if(entry == NULL){
+		return 0;
+	}
+	DEBUG_MSG(2, "QUEUE FULL!! EVICTED PACKET FROM: ", &entry->esender);
+	DTN_STAT(evicted);
+	dtn_remove_queued_packet(entry->item);
+	return 1;
+}
+
+/**
+ * @brief Number of packets that can be added without evicting any.
+ * @details Number of packets that can be added without evicting any. Free slots in the queue of the class,
+ *          and in the Flash Store if used.
+ * 
+ * @param tclass The class.
+ */
+static uint16_t
+room_left(uint8_t tclass){
+#if DTN_FLASH_STORE == 1
+	return dtn_class_size[tclass] - packetqueue_len(dtn_global.pkt_q[tclass]) + flash_free_count();
+#else
+	return dtn_class_size[tclass] - packetqueue_len(dtn_global.pkt_q[tclass]);
+#endif
+}
+
+/**
+ * @brief Find the tombstone of an End Sender.
+ * @details Find the tombstone of an End Sender.
+ * 
+ * @param esender The End Sender Address
+ * @return The tombstone or NULL (0) if none.
+ */
+static struct dtn_tombstone
+*tomb_find(const rimeaddr_t *esender){
+	int i;
+
+	for(i = 0; i < dtn_global.tomb_count; i++){
+		if(rimeaddr_cmp(&dtn_tombs[i].esender, esender) == 1){
+			return &dtn_tombs[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Check if the packet is known to be delivered.
+ * @details Check if the packet is known to be delivered. Packets older than the span of the tombstone are not known.
+ * 
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @return integer if 0 (False) if 1 (True)
+ */
+static int
+is_tombstone(uint16_t pkt_id, const rimeaddr_t *esender){
+	struct dtn_tombstone *tomb = tomb_find(esender);
+	uint16_t back;
+
+	if(tomb == NULL){
+		return 0;
+	}
+	back = tomb->epacketid - pkt_id;
+	if(back == 0){
+		return 1;
+	}
+	return (back <= DTN_TOMB_SPAN && (tomb->bitmap & ((uint16_t) 1 << (back - 1))) != 0);
+}
+
+/**
+ * @brief Mark a packet delivered in a tombstone.
+ * @details Mark a packet delivered in a tombstone. A newer packet becomes the highest ID and the bitmap is shifted.
+ *          An ID outside the window in either direction re-bases the tombstone on it.
+ * 
+ * @param dtn_tombstone The tombstone of the End Sender.
+ * @param pkt_id The packet id
+ * @return 1 (True) if the packet was not known, 0 (False) if already known.
+ */
+static int
+tomb_mark(struct dtn_tombstone *tomb, uint16_t pkt_id){
+	uint16_t back = tomb->epacketid - pkt_id;
+	uint16_t ahead = pkt_id - tomb->epacketid;
+
+	//Older
+	if(back != 0 && back <= DTN_TOMB_SPAN){
+		if((tomb->bitmap & ((uint16_t) 1 << (back - 1))) != 0){
+			return 0;
+		}
+		tomb->bitmap |= (uint16_t) 1 << (back - 1);
+		return 1;
+	}
+	//Newer. IDs wrap around so only half the space is ahead
+	if(ahead != 0 && ahead < 0x8000){
+		if(ahead > DTN_TOMB_SPAN){
+			tomb->bitmap = 0;
+		} else if(ahead == DTN_TOMB_SPAN){
+			tomb->bitmap = (uint16_t) 1 << (DTN_TOMB_SPAN - 1);
+		} else {
+			tomb->bitmap = (tomb->bitmap << ahead) | ((uint16_t) 1 << (ahead - 1));
+		}
+		tomb->epacketid = pkt_id;
+		return 1;
+	}
+	if(ahead == 0){
+		return 0;
+	}
+	//Outside the window. The End Sender rebooted into a lower epoch or its sequence wrapped, start again from this ID
+	tomb->epacketid = pkt_id;
+	tomb->bitmap = 0;
+	return 1;
+}
+
+/**
+ * @brief Remember that a packet has been delivered.
+ * @details Remember that a packet has been delivered. The oldest tombstone is overwritten when the ring is full 
+ *          and a new End Sender is seen. If the packet is queued it is removed since there is no need to spray it any more.
+ *          If this node is the End Sender the application is told. What was learnt is broadcasted on the next spray,
+ *          even if the queue is empty.
+ * 
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ */
+static void
+add_tombstone(uint16_t pkt_id, const rimeaddr_t *esender){
+	struct dtn_index_item *entry;
+	struct dtn_tombstone *tomb = tomb_find(esender);
+
+	if(tomb == NULL){
+		tomb = &dtn_tombs[dtn_global.tomb_next];
+		rimeaddr_copy(&tomb->esender, esender);
+		tomb->epacketid = pkt_id;
+		tomb->bitmap = 0;
+		dtn_global.tomb_next = (dtn_global.tomb_next + 1) % DTN_TOMBSTONES;
+		if(dtn_global.tomb_count < DTN_TOMBSTONES){
+			dtn_global.tomb_count += 1;
+		}
+	} else if(tomb_mark(tomb, pkt_id) == 0){
+		return;
+	}
+	dtn_global.tomb_pending = 1;
+
+	//Delivered! Tell the application
+	if(rimeaddr_cmp(esender, &rimeaddr_node_addr) == 1){
+		DTN_STAT(delivered_own);
+		if(dtn_global.callbacks != NULL && dtn_global.callbacks->delivered != NULL){
+			dtn_global.callbacks->delivered(pkt_id);
+		}
+	}
+
+	entry = index_find(pkt_id, esender);
+	if(entry != NULL){
+		DEBUG_MSG(3, "PACKET DELIVERED! REMOVED FROM QUEUE. ESENDER: ", esender);
+		dtn_remove_queued_packet(entry->item);
+	}
+#if DTN_FLASH_STORE == 1
+	if(flash_find(pkt_id, esender) >= 0){
+		flash_remove(flash_find(pkt_id, esender));
+	}
+#endif
+}
+
+/**
+ * @brief Add the tombstones at the end of the buffer.
+ * @details Add the tombstones at the end of the buffer. Starting from the latest as many are added 
+ *          as fit in max_len.
+ * 
+ * @param max_len The max length of the buffer data.
+ */
+static void
+append_tombstones(uint16_t max_len){
+	struct dtn_tombstone_header t_hdr;
+	uint16_t len = packetbuf_datalen();
+	uint8_t *ptr = (uint8_t*) packetbuf_dataptr() + len;
+	uint8_t pos = dtn_global.tomb_next;
+
+	dtn_global.tomb_pending = 0;
+	if(dtn_global.tomb_count == 0 || len + sizeof(t_hdr) + sizeof(struct dtn_tombstone) > max_len){
+		return;
+	}
+
+	t_hdr.magic = 'T';
+	t_hdr.num_tombstones = 0;
+	len += sizeof(t_hdr);
+	while(t_hdr.num_tombstones < dtn_global.tomb_count && len + sizeof(struct dtn_tombstone) <= max_len){
+		pos = (pos + DTN_TOMBSTONES - 1) % DTN_TOMBSTONES;
+		memcpy(ptr + len - packetbuf_datalen(), &dtn_tombs[pos], sizeof(struct dtn_tombstone));
+		len += sizeof(struct dtn_tombstone);
+		t_hdr.num_tombstones += 1;
+	}
+	memcpy(ptr, &t_hdr, sizeof(t_hdr));
+	packetbuf_set_datalen(len);
+}
+
+/**
+ * @brief Read the tombstones added at the end of a spray.
+ * @details Read the tombstones added at the end of a spray. Every delivered packet not known is saved 
+ *          and the packet is removed from the queue.
+ * 
+ * @param ptr Pointer to the tombstone header.
+ * @param len Number of bytes left in the spray.
+ */
+static void
+read_tombstones(uint8_t *ptr, uint16_t len){
+	struct dtn_tombstone_header t_hdr;
+	struct dtn_tombstone tomb;
+	uint8_t i;
+	uint8_t b;
+
+	if(len < sizeof(t_hdr)){
+		return;
+	}
+	memcpy(&t_hdr, ptr, sizeof(t_hdr));
+	if(t_hdr.magic != 'T' || len < sizeof(t_hdr) + t_hdr.num_tombstones * sizeof(struct dtn_tombstone)){
+		return;
+	}
+
+	ptr += sizeof(t_hdr);
+	for(i = 0; i < t_hdr.num_tombstones; i++){
+		//Might not be aligned
+		memcpy(&tomb, ptr, sizeof(tomb));
+		//Highest first so the older ones fall in the span
+		add_tombstone(tomb.epacketid, &tomb.esender);
+		for(b = 0; b < DTN_TOMB_SPAN; b++){
+			if((tomb.bitmap & ((uint16_t) 1 << b)) != 0){
+				add_tombstone(tomb.epacketid - 1 - b, &tomb.esender);
+			}
+		}
+		ptr += sizeof(tomb);
+	}
+}
+
+/**
+ * @brief Check if a fragment can be reassembled.
+ * @details Check if a fragment can be reassembled. Only one payload is reassembled at a time, 
+ *          once its deadline passed the fragments received are dropped.
+ * 
+ * @param dtn_msg_header Header of the fragment.
+ * @return 1 (True) if it can be reassembled, 0 (False) if another payload is being reassembled.
+ */
+static int
+can_reassemble(struct dtn_msg_header *hdr){
+	if(hdr->frag_total <= 1){
+		return 1;
+	}
+	//Missing fragments never came
+	if(dtn_reasm.in_use == 1 && !CLOCK_LT(clock_time(), dtn_reasm.deadline)){
+		DEBUG_MSG(2, "REASSEMBLY TIMEDOUT!! ESENDER: ", &dtn_reasm.esender);
+		dtn_reasm.in_use = 0;
+	}
+	if(dtn_reasm.in_use == 0){
+		return 1;
+	}
+	return (dtn_reasm.base_id == (uint16_t)(hdr->epacketid - hdr->frag_index) && 
+		rimeaddr_cmp(&dtn_reasm.esender, &hdr->esender) == 1);
+}
+
+/**
+ * @brief Hand a delivered payload to the application.
+ * @details Hand a delivered payload to the application.
+ * 
+ * @param from Address from whom the last packet was received.
+ * @param esender The End Sender of the payload.
+ * @param data The payload.
+ * @param len Length of the payload.
+ * @param age End to end latency in seconds. The age of the last packet received.
+ */
+static void
+deliver(const rimeaddr_t *from, const rimeaddr_t *esender, const uint8_t *data, uint16_t len, uint16_t age){
+	printf("- DELIVER - MY PRECIOUS!! :) !! -- FROM: %d SENDER: %d LEN: %d LATENCY: %u s\n", from->u8[0], esender->u8[0], len, age);
+	DTN_STAT(delivered);
+	if(dtn_global.callbacks != NULL && dtn_global.callbacks->recv != NULL){
+		dtn_global.callbacks->recv(esender, data, len);
+	}
+}
+
+/**
+ * @brief Deliver the packet in the buffer to this node.
+ * @details Deliver the packet in the buffer to this node. A fragment is copied to the reassembly
+ *          buffer and the payload is delivered once all fragments arrived. Every fragment is tombstoned on its own.
+ * 
+ * @param from Address from whom the packet was received.
+ * @return 1 (True) if delivered now or before, 0 (False) if there is no room to reassemble it.
+ */
+static int
+deliver_buf(const rimeaddr_t *from){
+	struct dtn_msg_header *hdr = (struct dtn_msg_header*) packetbuf_dataptr();
+	uint8_t *data = (uint8_t*) packetbuf_dataptr() + sizeof(struct dtn_msg_header);
+
+	if(is_tombstone(hdr->epacketid, &hdr->esender) == 1){
+		return 1;
+	}
+	if(can_reassemble(hdr) == 0){
+		DEBUG_MSG(2, "REASSEMBLY BUSY!! DROP FRAGMENT FROM: ", &hdr->esender);
+		return 0;
+	}
+	add_tombstone(hdr->epacketid, &hdr->esender);
+
+	//Not fragmented
+	if(hdr->frag_total == 1){
+		deliver(from, &hdr->esender, data, hdr->data_len, hdr->age);
+		return 1;
+	}
+
+	if(dtn_reasm.in_use == 0){
+		dtn_reasm.in_use = 1;
+		rimeaddr_copy(&dtn_reasm.esender, &hdr->esender);
+		dtn_reasm.base_id = hdr->epacketid - hdr->frag_index;
+		dtn_reasm.frag_total = hdr->frag_total;
+		dtn_reasm.received = 0;
+		dtn_reasm.len = 0;
+		dtn_reasm.deadline = clock_time() + dtn_conf.max_lifetime;
+	}
+	memcpy(dtn_reasm.data + hdr->frag_index * DTN_FRAG_SIZE, data, hdr->data_len);
+	dtn_reasm.received |= (1 << hdr->frag_index);
+	dtn_reasm.len += hdr->data_len;
+
+	//All fragments arrived
+	if(dtn_reasm.received == (1 << dtn_reasm.frag_total) - 1){
+		dtn_reasm.in_use = 0;
+		deliver(from, &dtn_reasm.esender, dtn_reasm.data, dtn_reasm.len, hdr->age);
+	}
+	return 1;
+}
+
+/**
+ * @brief Handle queue broadcast. Timer are set according to need.
+ * @details Handle queue broadcast. A message is sent in interval set in packet_delay of the configuration,
+ *          this helps reduce traffic in channel making it more probable to receive a runicast.
+ *          After all the queue is broadcasted a delay of DTN_QUEUE_DELAY is introduced to 
+ *          reduce traffic on the channel. The function also checks that the number of copies is larger
+ *          equak to 1. 
+ * 
+ * @param p_item Not used! The packet item sent is stored in the global variable.
+ */
+static void
+broadcast_next(void *p_item);
+#if DTN_STATS == 1 && DTN_ENERGEST == 1
+static void
+broadcast_next_metered(void *p_item);
+#endif
+
+/**
+ * @brief Set the timer of the next broadcast.
+ * @details Set the timer of the next broadcast. With the Adaptive Cadence the delay is picked at random 
+ *          in its second half.
+ * 
+ * @param delay The delay.
+ */
+static void
+schedule_next(clock_time_t delay){
+	if(DTN_ADAPTIVE_CADENCE == 1){
+		delay = delay / 2 + random_rand() % (delay / 2 + 1);
+	}
+	ctimer_set(&dtn_global.local_ctimer, delay, DTN_METERED(broadcast_next), &dtn_global.pkt_last_sent);
+}
+
+/**
+ * @brief Delay after a round of the queue.
+ * @details Delay after a round of the queue. DTN_QUEUE_DELAY, or with the Adaptive Cadence the
+ *          current cadence. It is doubled for the next round if no request came back.
+ */
+static clock_time_t
+round_delay(){
+	clock_time_t delay = dtn_global.cadence;
+
+	if(DTN_ADAPTIVE_CADENCE == 0){
+		return dtn_conf.queue_delay;
+	}
+	//Nobody answered! Back off
+	if(dtn_global.responded == 0){
+		dtn_global.cadence = (dtn_global.cadence >= DTN_CADENCE_MAX / 2) ? DTN_CADENCE_MAX : dtn_global.cadence * 2;
+	}
+	dtn_global.responded = 0;
+	return delay;
+}
+
+/**
+ * @brief Reset the Adaptive Cadence.
+ * @details Reset the Adaptive Cadence to DTN_CADENCE_MIN. If the timer was backed off it is set again.
+ */
+static void
+cadence_reset(){
+	if(DTN_ADAPTIVE_CADENCE == 0){
+		return;
+	}
+	dtn_global.responded = 1;
+	if(dtn_global.cadence == DTN_CADENCE_MIN){
+		return;
+	}
+	dtn_global.cadence = DTN_CADENCE_MIN;
+	schedule_next(DTN_CADENCE_MIN);
+}
+
+/**
+ * @brief Add the packet in the buffer to the queue and the bundle index.
+ * @details Add the packet in the buffer to the queue and the bundle index. The buffer is cleared.
+ * 
+ * @param dtn_msg_header Header of the packet in the buffer.
+ * @param delay Lifetime of the packet in the queue.
+ * @return 1 (True) if queued, 0 (False) if no index entry or queue buffer was free.
+ */
+static int
+enqueue_buf(struct dtn_msg_header *hdr, clock_time_t delay){
+	struct dtn_index_item *entry;
+
+	entry = index_add(hdr);
+	if(entry == NULL){
+		DTN_STAT(drop_no_buffer);
+		packetbuf_clear();
+		return 0;
+	}
+
+	//Enqueue Received Buffer. Lifetime is handled by the expiry list, not by the packet queue.
+	if(packetqueue_enqueue_packetbuf(dtn_global.pkt_q[hdr->tclass], 0, entry) == 0){
+		DEBUG_MSG(2, "NO QUEUE BUFFER FREE!! DROPPED. ESENDER: ", &hdr->esender);
+		DTN_STAT(drop_no_buffer);
+		index_remove(entry);
+		packetbuf_clear();
+		return 0;
+	}
+	//Enqueue adds at the end of the queue. list_add() and list_tail() walk the queue, O(n) as set_lifetime()
+	entry->item = list_tail(*dtn_global.pkt_q[hdr->tclass]->list);
+	session_moved(entry->item, 1);
+	set_lifetime(entry->item, delay);
+	//New packet! Spray it soon
+	cadence_reset();
+#if DTN_STATS == 1
+	if(dtn_q_size() > dtn_stat.queue_high){
+		dtn_stat.queue_high = dtn_q_size();
+	}
+#endif
+	//Clear Buffer
+	packetbuf_clear();
+	return 1;
+}
+
+/**
+ * @brief Save buffer item in queue.
+ * @details Save buffer item in queue. If the packet has just received set number of copies to 0. 
+ *          Since no hand off has been given. 0 shows that no runicast has been received.
+ * 
+ * @param isReceived If the packet has just been received set to 1 (True) if from queue set to 0 (False)
+ * @return 1 (True) if queued, 0 (False) if not.
+ */
+int
+queue_buf(int isReceived){
+	struct dtn_msg_header *hdr;
+	int delay = dtn_conf.handoff_wait;
+
+	if(isReceived == 1){
+		//Received. Header is in data section
+		hdr = (struct dtn_msg_header*) packetbuf_dataptr();
+		//update number of copies to 0. No Runic yeath!
+		hdr->num_copies = 0;
+	} else {
+		//Created locally. Header is in header section
+		hdr = (struct dtn_msg_header*) packetbuf_hdrptr();
+		delay = calculate_max_lifetime(hdr->num_copies);
+	}
+
+	return enqueue_buf(hdr, delay);
+}
+
+/**
+ * @brief Find a staged packet.
+ * @details Find a staged packet. Slots whose deadline passed are freed on the way.
+ * 
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @return The staging slot or NULL (0) if not found.
+ */
+static struct dtn_stage
+*stage_find(uint16_t pkt_id, const rimeaddr_t *esender){
+	struct dtn_stage *st;
+	struct dtn_stage *st_next;
+	struct dtn_msg_header *hdr;
+	clock_time_t now = clock_time();
+
+	for(st = list_head((list_t) &dtn_stage_list); st != NULL; st = st_next){
+		st_next = st->next;
+		//Handoff never came
+		if(!CLOCK_LT(now, st->deadline)){
+			list_remove((list_t) &dtn_stage_list, st);
+			memb_free(&dtn_stage_memb, st);
+			continue;
+		}
+		hdr = (struct dtn_msg_header*) st->bundle;
+		if(hdr->epacketid == pkt_id && rimeaddr_cmp(&hdr->esender, esender) == 1){
+			return st;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Stage the received packet in the buffer until its handoff arrives.
+ * @details Stage the received packet in the buffer until its handoff arrives. If all slots are taken
+ *          the oldest one is reused, a newer request is more likely to be answered.
+ * 
+ * @param dtn_msg_header Header of the packet in the buffer.
+ */
+static void
+stage_buf(struct dtn_msg_header *hdr){
+	struct dtn_stage *st = stage_find(hdr->epacketid, &hdr->esender);
+	uint16_t len = packetbuf_datalen();
+
+	if(st == NULL){
+		st = memb_alloc(&dtn_stage_memb);
+	}
+	if(st == NULL){
+		st = list_head((list_t) &dtn_stage_list);
+		DEBUG_MSG(3, "STAGING FULL!! REUSE SLOT OF: ", &((struct dtn_msg_header*) st->bundle)->esender);
+	}
+	//Moved to the end. List stays sorted by deadline
+	list_remove((list_t) &dtn_stage_list, st);
+
+	if(len > sizeof(st->bundle)){
+		len = sizeof(st->bundle);
+	}
+	memcpy(st->bundle, hdr, len);
+	st->len = len;
+	st->deadline = clock_time() + dtn_conf.handoff_wait;
+	list_add((list_t) &dtn_stage_list, st);
+}
+
+/**
+ * @brief Queue a staged packet with the copies confirmed by the handoff.
+ * @details Queue a staged packet with the copies confirmed by the handoff. The staging slot is freed.
+ *          The buffer is overwritten.
+ * 
+ * @param dtn_stage The staging slot.
+ * @param num_copies The copies given by the handoff.
+ */
+static void
+stage_commit(struct dtn_stage *st, uint16_t num_copies){
+	struct dtn_msg_header *hdr;
+
+	packetbuf_copyfrom(st->bundle, st->len);
+	list_remove((list_t) &dtn_stage_list, st);
+	memb_free(&dtn_stage_memb, st);
+
+	hdr = (struct dtn_msg_header*) packetbuf_dataptr();
+	hdr->num_copies = num_copies;
+	enqueue_buf(hdr, calculate_max_lifetime(num_copies));
+}
+
+/**
+ * @brief Load the packet item into the buffer.
+ * @details Load the packet item into the buffer. If loading packet for Broadcast check that number of copies is not 0.
+ * 
+ * @param packetqueue_item The packet queue item needed to be loaded in the buffer.
+ * @param is_bcast If loading packet for a broadcast set to 1 (True) else 0 (False).
+ * @return integer if 0 (False) if 1 (True)
+ */
+static int
+load_pkt_item(struct packetqueue_item *item, uint8_t is_bcast){
+	struct queuebuf *q_buf;
+	struct dtn_msg_header *hdr;
+
+	//Get Queue buffer from packetqueue_item
+	q_buf = packetqueue_queuebuf(item);
+
+	//If bcast check that L != 0
+	if(is_bcast == 1){
+		hdr = (struct dtn_msg_header*) queuebuf_dataptr(q_buf);
+		if(hdr->num_copies == 0){
+			return 0;
+		}
+	}
+	//Convert buff to header
+	queuebuf_to_packetbuf(q_buf);
+	return 1;
+}
+
+/**
+ * @brief Remove data from buffer.
+ * @details Remove data from buffer. The header leads the data section so the data is cut off in place.
+ *          The header is not copied over itself.
+ */
+static void
+remove_data_from_buf(){
+	packetbuf_set_datalen(sizeof(struct dtn_msg_header));
+}
+
+/**
+ * @brief Load header only to buffer.
+ * @details Load header only to buffer. The header is copied straight from the queue buffer, 
+ *          alterations are made to the buffer copy only.
+ * 
+ * @param packetqueue_item The packet queue item to load.
+ * @param isHalved Should the numb_copies be halved? if 1(True) half if 0 (False) leave as is.
+ */
+static void
+load_hdr_item(struct packetqueue_item *item, int isHalved){
+	struct dtn_msg_header *hdr;
+
+	//Add Header in data buffer
+	packetbuf_copyfrom(get_hdr_buff(item), sizeof(struct dtn_msg_header));
+	hdr = (struct dtn_msg_header*) packetbuf_dataptr();
+	//Half value. Sending with runicast
+	if(isHalved == 1 && hdr->num_copies >= 2){
+		hdr->num_copies = ceiling_divider(hdr->num_copies, 2);
+	}
+}
+
+/**
+ * @brief Load header and data to buffer.
+ * @details Load header and data to buffer. Used for the handoff in Offer Mode since the neighbour did not
+ *          receive the data with the offer. Alterations are made to the buffer copy only.
+ * 
+ * @param packetqueue_item The packet queue item to load.
+ */
+static void
+load_bundle_item(struct packetqueue_item *item){
+	queuebuf_to_packetbuf(packetqueue_queuebuf(item));
+}
+
+/**
+* Parse through queue and broadcast
+*/
+/**
+ * @brief Search in queue and find packet with same epacketid, esender and ereceiver.
+ * @details Search in queue and find packet with same epacketid, esender and ereceiver. 
+ *          The packet is looked up in the bundle index.
+ * 
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @param ereceiver The End Receiver Address
+ * @return Packet Queue Pointer or NULL (0) if not found.
+ */
+static struct packetqueue_item
+*find_packet(uint16_t pkt_id, const rimeaddr_t *esender, const rimeaddr_t *ereceiver){
+	struct dtn_index_item *entry = index_find(pkt_id, esender);
+
+	if(entry == NULL || rimeaddr_cmp(&entry->ereceiver, ereceiver) == 0){
+		return NULL;
+	}
+	return entry->item;
+}
+
+/**
+ * @brief Search in queue and find packet with same epacketid and esender.
+ * @details Search in queue and find packet with same epacketid and esender.
+ * 
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @return Packet Queue Pointer or NULL (0) if not found.
+ */
+static struct packetqueue_item
+*find_packet_item(uint16_t pkt_id, const rimeaddr_t *esender){
+	struct dtn_index_item *entry = index_find(pkt_id, esender);
+
+	return (entry == NULL) ? NULL : entry->item;
+}
+
+#if DTN_FLASH_STORE == 1
+/**
+ * @brief Page a packet in from the Flash Store.
+ * @details Page a packet in from the Flash Store. One packet is paged in every time it is called, 
+ *          as long as a slot in the queue of its class stays free for packets received. The packet is queued with a new lifetime.
+ *          A packet whose end to end lifetime is over is dropped.
+ */
+static void
+flash_page_in(){
+	struct dtn_msg_header *hdr;
+	struct dtn_flash_entry *entry;
+	uint8_t i;
+	uint8_t len;
+	int fd;
+	int read;
+
+	for(i = 0; i < DTN_FLASH_BUNDLES; i++){
+		entry = &dtn_flash[(dtn_global.flash_read + i) % DTN_FLASH_BUNDLES];
+		if(entry->in_use == 1 && entry->tclass < DTN_CLASSES && 
+				packetqueue_len(dtn_global.pkt_q[entry->tclass]) < dtn_class_size[entry->tclass] - 1){
+			break;
+		}
+	}
+	if(i == DTN_FLASH_BUNDLES){
+		return;
+	}
+	i = (dtn_global.flash_read + i) % DTN_FLASH_BUNDLES;
+	dtn_global.flash_read = (i + 1) % DTN_FLASH_BUNDLES;
+
+	fd = cfs_open(DTN_FLASH_LOG, CFS_READ);
+	if(fd < 0){
+		return;
+	}
+	len = dtn_flash[i].len;
+	packetbuf_clear();
+	cfs_seek(fd, (cfs_offset_t) i * DTN_FLASH_RECORD, CFS_SEEK_SET);
+	read = cfs_read(fd, packetbuf_dataptr(), len);
+	cfs_close(fd);
+	flash_remove(i);
+	if(read != len){
+		return;
+	}
+	packetbuf_set_datalen(len);
+
+	hdr = (struct dtn_msg_header*) packetbuf_dataptr();
+	if(is_spray_wait(hdr) == 0 || is_tombstone(hdr->epacketid, &hdr->esender) == 1 ||
+			find_packet_item(hdr->epacketid, &hdr->esender) != NULL){
+		return;
+	}
+	//End to end lifetime over, it would expire at once
+	if(hdr->age >= hdr->ttl){
+		DTN_STAT(expired);
+		return;
+	}
+	DEBUG_MSG(3, "PACKET PAGED IN FROM FLASH! ESENDER: ", &hdr->esender);
+	enqueue_buf(hdr, calculate_max_lifetime(hdr->num_copies));
+}
+#endif
+
+/*--------------------------------- Strategies ------------------------------------*/
+
+#if DTN_STRATEGY != DTN_STRATEGY_EPIDEMIC
+/**
+ * @brief Copies kept once a handoff was ACKed. Used by the Spray and Wait strategies.
+ * @details Copies kept once a handoff was ACKed. The copies given are taken, at least 1 is kept 
+ *          to wait for the End Receiver.
+ * 
+ * @param num_copies The copies held.
+ * @param given The copies given.
+ * @return The copies kept.
+ */
+static uint16_t
+spray_kept(uint16_t num_copies, uint16_t given){
+	return (num_copies > given) ? num_copies - given : 1;
+}
+#endif
+
+/**
+ * @brief Check if a relay should ask for a sprayed packet. Used by the Spray and Wait strategies.
+ * @details Check if a relay should ask for a sprayed packet. A packet with 1 copy is searching for 
+ *          its End Receiver so it is not asked for.
+ * 
+ * @param dtn_msg_header Header of the sprayed packet.
+ * @return 1 (True) if asked for, 0 (False) if not.
+ */
+static uint8_t
+spray_wants(const struct dtn_msg_header *hdr){
+	return hdr->num_copies > 1;
+}
+
+#if DTN_STRATEGY == DTN_STRATEGY_SPRAY_WAIT || DTN_STRATEGY == DTN_STRATEGY_PROPHET
+/**
+ * @brief Copies given by Binary Spray and Wait.
+ * @details Copies given by Binary Spray and Wait. Half of the copies available, nothing if 1 is left.
+ */
+static uint16_t
+binary_copies(const struct dtn_msg_header *hdr, uint16_t available, const rimeaddr_t *to, uint16_t metric){
+	if(available < 2){
+		return 0;
+	}
+	return ceiling_divider(available, 2);
+}
+#endif
+
+#if DTN_STRATEGY == DTN_STRATEGY_SPRAY_WAIT
+static const struct dtn_strategy dtn_strategy = {NULL, NULL, spray_wants, NULL, binary_copies, spray_kept};
+#endif
+
+#if DTN_STRATEGY == DTN_STRATEGY_SOURCE_SPRAY
+/**
+ * @brief Copies given by Source Spray and Wait.
+ * @details Copies given by Source Spray and Wait. The End Sender gives 1 copy while it has more than 1,
+ *          a relay waits for the End Receiver.
+ */
+static uint16_t
+source_copies(const struct dtn_msg_header *hdr, uint16_t available, const rimeaddr_t *to, uint16_t metric){
+	if(available < 2 || rimeaddr_cmp(&hdr->esender, &rimeaddr_node_addr) == 0){
+		return 0;
+	}
+	return 1;
+}
+
+static const struct dtn_strategy dtn_strategy = {NULL, NULL, spray_wants, NULL, source_copies, spray_kept};
+#endif
+
+#if DTN_STRATEGY == DTN_STRATEGY_EPIDEMIC
+/**
+ * @brief Copies given by Capped Epidemic.
+ * @details Copies given by Capped Epidemic. The neighbour gets the hop budget left minus 1.
+ */
+static uint16_t
+epidemic_copies(const struct dtn_msg_header *hdr, uint16_t available, const rimeaddr_t *to, uint16_t metric){
+	if(available < 2){
+		return 0;
+	}
+	return available - 1;
+}
+
+/**
+ * @brief Copies kept by Capped Epidemic.
+ * @details Copies kept by Capped Epidemic. Giving a copy does not use the hop budget of this node.
+ */
+static uint16_t
+epidemic_kept(uint16_t num_copies, uint16_t given){
+	return num_copies;
+}
+
+static const struct dtn_strategy dtn_strategy = {NULL, NULL, spray_wants, NULL, epidemic_copies, epidemic_kept};
+#endif
+
+#if DTN_STRATEGY == DTN_STRATEGY_PROPHET
+/**
+ * @brief The delivery predictabilities of PRoPHET.
+ */
+static struct dtn_prophet dtn_prophet[DTN_PROPHET_ENTRIES];
+
+/**
+ * @brief Find the delivery predictability for an End Receiver.
+ * @details Find the delivery predictability for an End Receiver. The predictability is aged by 
+ *          DTN_PROPHET_GAMMA for every DTN_PROPHET_AGE_UNIT passed. If not found and is_add is set the 
+ *          lowest predictability is replaced.
+ * 
+ * @param addr The End Receiver.
+ * @param is_add If 1 (True) an entry is added if not found.
+ * @return The entry or NULL (0) if not found and not added.
+ */
+static struct dtn_prophet
+*prophet_find(const rimeaddr_t *addr, uint8_t is_add){
+	clock_time_t now = clock_time();
+	struct dtn_prophet *entry = NULL;
+	struct dtn_prophet *lowest = NULL;
+	int i;
+
+	for(i = 0; i < DTN_PROPHET_ENTRIES && entry == NULL; i++){
+		if(rimeaddr_cmp(&dtn_prophet[i].addr, addr) == 1){
+			entry = &dtn_prophet[i];
+		} else if(lowest == NULL || dtn_prophet[i].p < lowest->p){
+			lowest = &dtn_prophet[i];
+		}
+	}
+	if(entry == NULL){
+		if(is_add == 0){
+			return NULL;
+		}
+		entry = lowest;
+		rimeaddr_copy(&entry->addr, addr);
+		entry->p = 0;
+		entry->aged = now;
+	}
+
+	while(entry->p > 0 && (clock_time_t)(now - entry->aged) >= DTN_PROPHET_AGE_UNIT){
+		entry->p = ((uint16_t) entry->p * DTN_PROPHET_GAMMA) / 256;
+		entry->aged += DTN_PROPHET_AGE_UNIT;
+	}
+	if(entry->p == 0){
+		entry->aged = now;
+	}
+	return entry;
+}
+
+/**
+ * @brief Clear the delivery predictabilities.
+ * @details Clear the delivery predictabilities.
+ */
+static void
+prophet_init(){
+	memset(dtn_prophet, 0, sizeof(dtn_prophet));
+}
+
+/**
+ * @brief Raise the delivery predictability of a neighbour met.
+ * @details Raise the delivery predictability of a neighbour met by DTN_PROPHET_P_INIT of the part missing.
+ */
+static void
+prophet_encounter(const rimeaddr_t *neighbour){
+	struct dtn_prophet *entry = prophet_find(neighbour, 1);
+
+	entry->p += ((uint16_t)(255 - entry->p) * DTN_PROPHET_P_INIT) / 255;
+}
+
+/**
+ * @brief The delivery predictability for an End Receiver. Sent with a request.
+ * @details The delivery predictability for an End Receiver. Sent with a request.
+ */
+static uint16_t
+prophet_metric(const rimeaddr_t *ereceiver){
+	struct dtn_prophet *entry = prophet_find(ereceiver, 0);
+
+	return (entry == NULL) ? 0 : entry->p;
+}
+
+/**
+ * @brief Copies given by PRoPHET.
+ * @details Copies given by PRoPHET. The transitive predictability through the neighbour is learnt 
+ *          from the metric of its request. Half of the copies are given if the neighbour is more likely 
+ *          to meet the End Receiver.
+ */
+static uint16_t
+prophet_copies(const struct dtn_msg_header *hdr, uint16_t available, const rimeaddr_t *to, uint16_t metric){
+	struct dtn_prophet *entry;
+	uint16_t p_to = prophet_metric(to);
+	uint16_t p_trans = ((p_to * metric) / 255 * DTN_PROPHET_BETA) / 256;
+
+	entry = prophet_find(&hdr->ereceiver, p_trans > 0);
+	if(entry != NULL && p_trans > entry->p){
+		entry->p = p_trans;
+	}
+	if(metric <= ((entry == NULL) ? 0 : entry->p)){
+		return 0;
+	}
+	return binary_copies(hdr, available, to, metric);
+}
+
+static const struct dtn_strategy dtn_strategy = {prophet_init, prophet_encounter, spray_wants, prophet_metric, prophet_copies, spray_kept};
+#endif
+
+/**
+ * @brief Find a neighbour in the contact table.
+ * @details Find a neighbour in the contact table. If not found the neighbour active the longest time ago 
+ *          is replaced. A new entry has not been heard within DTN_CONTACT_TIMEOUT.
+ * 
+ * @param from The neighbour address.
+ * @return The contact.
+ */
+static struct dtn_contact
+*contact_find(const rimeaddr_t *from){
+	clock_time_t now = clock_time();
+	struct dtn_contact *oldest = NULL;
+	clock_time_t active;
+	clock_time_t oldest_active = 0;
+	int i;
+
+	for(i = 0; i < DTN_CONTACTS; i++){
+		if(rimeaddr_cmp(&dtn_contacts[i].addr, from) == 1){
+			return &dtn_contacts[i];
+		}
+		active = CLOCK_LT(dtn_contacts[i].last_seen, dtn_contacts[i].last_heard) ? dtn_contacts[i].last_heard : dtn_contacts[i].last_seen;
+		if(oldest == NULL || CLOCK_LT(active, oldest_active)){
+			oldest = &dtn_contacts[i];
+			oldest_active = active;
+		}
+	}
+
+	rimeaddr_copy(&oldest->addr, from);
+	oldest->last_seen = now - DTN_CONTACT_TIMEOUT - 1;
+	oldest->last_heard = now - DTN_CONTACT_TIMEOUT - 1;
+	oldest->rssi = 0;
+	oldest->lqi = 0;
+	oldest->role = DTN_ROLE_STATIC;
+	oldest->capacity = 0;
+	return oldest;
+}
+
+/**
+ * @brief Update the link quality of a neighbour from the frame in the buffer.
+ * @details Update the link quality of a neighbour from the RSSI and link quality of the frame in the buffer. 
+ *          The average is started again for a new contact.
+ * 
+ * @param contact The neighbour the frame was received from.
+ * @param is_new 1 (True) if the neighbour was not heard within DTN_CONTACT_TIMEOUT.
+ */
+static void
+contact_link(struct dtn_contact *contact, uint8_t is_new){
+	int16_t rssi = (int16_t) packetbuf_attr(PACKETBUF_ATTR_RSSI);
+	uint16_t lqi = packetbuf_attr(PACKETBUF_ATTR_LINK_QUALITY);
+
+	if(is_new == 1){
+		contact->rssi = rssi;
+		contact->lqi = lqi;
+		return;
+	}
+	contact->rssi = (3 * contact->rssi + rssi) / 4;
+	contact->lqi = (3 * contact->lqi + lqi) / 4;
+}
+
+/**
+ * @brief Handle a new encounter.
+ * @details Handle a new encounter. The strategy is told and a configuration that was changed is passed on.
+ * 
+ * @param from The neighbour address.
+ */
+static void
+contact_encounter(const rimeaddr_t *from){
+	if(dtn_strategy.encounter != NULL){
+		dtn_strategy.encounter(from);
+	}
+	if(dtn_conf.seq != 0){
+		dtn_global.config_pending = 1;
+	}
+}
+
+/**
+ * @brief Remember that a neighbour has sent a request.
+ * @details Remember that a neighbour has sent a request.
+ * 
+ * @param from The neighbour address.
+ * @return 1 (True) if the neighbour is a new contact, 0 (False) if heard within DTN_CONTACT_TIMEOUT.
+ */
+static uint8_t
+contact_heard(const rimeaddr_t *from){
+	clock_time_t now = clock_time();
+	struct dtn_contact *contact = contact_find(from);
+	uint8_t is_new = (clock_time_t)(now - contact->last_seen) > DTN_CONTACT_TIMEOUT;
+
+	contact_link(contact, is_new);
+	contact->last_seen = now;
+	//Not heard by broadcast either. A new encounter
+	if(is_new == 1 && (clock_time_t)(now - contact->last_heard) > DTN_CONTACT_TIMEOUT){
+		contact_encounter(from);
+	}
+	return is_new;
+}
+
+/**
+ * @brief Remember that a neighbour has sent a broadcast.
+ * @details Remember that a neighbour has sent a broadcast.
+ * 
+ * @param from The neighbour address.
+ * @return 1 (True) if the neighbour is new around, 0 (False) if heard within DTN_CONTACT_TIMEOUT.
+ */
+static uint8_t
+contact_sprayed(const rimeaddr_t *from){
+	clock_time_t now = clock_time();
+	struct dtn_contact *contact = contact_find(from);
+	uint8_t is_new = (clock_time_t)(now - contact->last_heard) > DTN_CONTACT_TIMEOUT;
+
+	contact_link(contact, is_new);
+	contact->last_heard = now;
+	//Not heard by request either. A new encounter
+	if(is_new == 1 && (clock_time_t)(now - contact->last_seen) > DTN_CONTACT_TIMEOUT){
+		contact_encounter(from);
+	}
+	return is_new;
+}
+
+/**
+ * @brief Check if the link to a neighbour is good enough for a handoff.
+ * @details Check if the average link quality of a neighbour reaches DTN_LINK_MIN_LQI. 
+ *          Always good if DTN_LINK_AWARE is 0.
+ * 
+ * @param from The neighbour address.
+ * @return 1 (True) if a handoff can be sent, 0 (False) if the link is too weak.
+ */
+static uint8_t
+contact_link_ok(const rimeaddr_t *from){
+	if(DTN_LINK_AWARE == 0){
+		return 1;
+	}
+	return contact_find(from)->lqi >= DTN_LINK_MIN_LQI;
+}
+
+/**
+ * @brief Check if a contact was heard within DTN_CONTACT_TIMEOUT.
+ * @details Check if a contact was heard within DTN_CONTACT_TIMEOUT, by a request, broadcast or beacon.
+ * 
+ * @param contact The contact to check.
+ * @return 1 (True) if the neighbour is around, 0 (False) if not.
+ */
+static uint8_t
+contact_is_near(const struct dtn_contact *contact){
+	clock_time_t active = CLOCK_LT(contact->last_seen, contact->last_heard) ? contact->last_heard : contact->last_seen;
+
+	if(rimeaddr_cmp(&contact->addr, &rimeaddr_null) == 1){
+		return 0;
+	}
+	return (clock_time_t)(clock_time() - active) <= DTN_CONTACT_TIMEOUT;
+}
+
+/**
+ * @brief Check if a neighbour is around.
+ * @details Check if a neighbour is around. The contact table is not changed.
+ * 
+ * @param addr The neighbour address.
+ * @return 1 (True) if heard within DTN_CONTACT_TIMEOUT, 0 (False) if not.
+ */
+static uint8_t
+contact_present(const rimeaddr_t *addr){
+	int i;
+
+	for(i = 0; i < DTN_CONTACTS; i++){
+		if(rimeaddr_cmp(&dtn_contacts[i].addr, addr) == 1){
+			return contact_is_near(&dtn_contacts[i]);
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Check if any neighbour is around.
+ * @details Check if any neighbour was heard within DTN_CONTACT_TIMEOUT.
+ * 
+ * @return 1 (True) if not alone, 0 (False) if alone.
+ */
+static uint8_t
+neighbours_present(){
+	int i;
+
+	for(i = 0; i < DTN_CONTACTS; i++){
+		if(contact_is_near(&dtn_contacts[i]) == 1){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Check if a neighbour around is a ferry.
+ * @details Check if a neighbour around is a ferry, as advertised by its beacons.
+ * 
+ * @param addr The neighbour address.
+ * @param need_room If 1 (True) the ferry must also have room in its queue.
+ * @return 1 (True) if it is a ferry, 0 (False) if not or not around.
+ */
+static int
+contact_is_ferry(const rimeaddr_t *addr, uint8_t need_room){
+	int i;
+
+	for(i = 0; i < DTN_CONTACTS; i++){
+		if(rimeaddr_cmp(&dtn_contacts[i].addr, addr) == 1){
+			return (dtn_contacts[i].role == DTN_ROLE_FERRY && (need_room == 0 || dtn_contacts[i].capacity > 0) &&
+				contact_is_near(&dtn_contacts[i]));
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Check if a ferry with room is around.
+ * @details Check if a ferry with room is around.
+ * @return 1 (True) if a ferry is around, 0 (False) if not.
+ */
+static int
+ferry_present(){
+	int i;
+
+	for(i = 0; i < DTN_CONTACTS; i++){
+		if(dtn_contacts[i].role == DTN_ROLE_FERRY && dtn_contacts[i].capacity > 0 && contact_is_near(&dtn_contacts[i])){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Check if a queued packet is worth spraying.
+ * @details Check if a queued packet is worth spraying. A packet with no copies is never sprayed. With 
+ *          DTN_BEACONS a packet with 1 copy only searches for its End Receiver, so it is only sprayed 
+ *          while the End Receiver is around. Or with DTN_FERRY_CUSTODY while a ferry is around.
+ * 
+ * @param dtn_msg_header Header of the queued packet.
+ * @return 1 (True) if the packet should be sprayed, 0 (False) if not.
+ */
+static uint8_t
+is_worth_spraying(const struct dtn_msg_header *hdr){
+	if(hdr->num_copies < 1){
+		return 0;
+	}
+	if(DTN_BEACONS == 1 && hdr->num_copies == 1){
+		//The last copy is handed to a ferry with custody
+		if(DTN_FERRY_CUSTODY == 1 && DTN_ROLE == DTN_ROLE_STATIC && ferry_present() == 1){
+			return 1;
+		}
+		return contact_present(&hdr->ereceiver);
+	}
+	return 1;
+}
+
+/**
+ * @brief Send a beacon on DTN_BEACON_CHANNEL.
+ * @details Send a beacon on DTN_BEACON_CHANNEL and set the timer of the next one. The interval is 
+ *          jittered around DTN_BEACON_INTERVAL so the beacons of neighbours do not collide.
+ * 
+ * @param ptr Not used.
+ */
+static void
+beacon_send(void *ptr){
+	struct dtn_beacon *beacon;
+	uint16_t spare;
+
+	packetbuf_clear();
+	beacon = (struct dtn_beacon*) packetbuf_dataptr();
+	beacon->protocol.version = DTN_VERSION;
+	beacon->protocol.type = 'H';
+	beacon->role = DTN_ROLE;
+	spare = room_left(DTN_CLASS_ALARM) + room_left(DTN_CLASS_TELEMETRY) + room_left(DTN_CLASS_BULK);
+	beacon->capacity = (spare > 0xFF) ? 0xFF : spare;
+	packetbuf_set_datalen(sizeof(struct dtn_beacon));
+	broadcast_send(&dtn_chan.beacon);
+
+	ctimer_set(&dtn_global.beacon_ctimer, DTN_BEACON_INTERVAL / 2 + random_rand() % DTN_BEACON_INTERVAL, beacon_send, NULL);
+}
+
+/*------------------------------------- Configuration ----------------------------*/
+
+/**
+ * @brief Check that a configuration can be used.
+ * @details Check that a configuration can be used. No parameter can be 0. The delays must be within half 
+ *          the clock range, so the deadlines set from them stay ordered by CLOCK_LT(), and fit the 16 bit ms of 
+ *          struct dtn_config_msg. The lifetime must be between 1 s and DTN_LIFETIME_CAP, which also fits the 
+ *          16 bit s of struct dtn_config_msg.
+ * 
+ * @param dtn_config The configuration.
+ * @return 1 (True) if it can be used, 0 (False) if not.
+ */
+static int
+config_valid(const struct dtn_config *conf){
+	uint8_t c;
+
+	for(c = 0; c < DTN_CLASSES; c++){
+		if(conf->copies[c] == 0){
+			return 0;
+		}
+	}
+	if(conf->packet_delay == 0 || conf->queue_delay == 0 || conf->handoff_wait == 0 || conf->max_transmissions == 0){
+		return 0;
+	}
+	if(conf->packet_delay > DTN_CLOCK_HALF || conf->queue_delay > DTN_CLOCK_HALF || conf->handoff_wait > DTN_CLOCK_HALF){
+		return 0;
+	}
+	//Sent in ms on 16 bits by config_send()
+	if((uint32_t) conf->packet_delay * 1000 / CLOCK_SECOND > 0xFFFF || 
+		(uint32_t) conf->queue_delay * 1000 / CLOCK_SECOND > 0xFFFF || 
+		(uint32_t) conf->handoff_wait * 1000 / CLOCK_SECOND > 0xFFFF){
+		return 0;
+	}
+	return (conf->max_lifetime >= CLOCK_SECOND && conf->max_lifetime <= DTN_LIFETIME_CAP);
+}
+
+/**
+ * @brief Broadcast the configuration.
+ * @details Broadcast the configuration on the spray channel. Delays are sent in ms and the lifetime in seconds.
+ */
+static void
+config_send(){
+	struct dtn_config_msg *msg;
+
+	dtn_global.config_pending = 0;
+	packetbuf_clear();
+	msg = (struct dtn_config_msg*) packetbuf_dataptr();
+	msg->protocol.version = DTN_VERSION;
+	msg->protocol.type = 'C';
+	msg->seq = dtn_conf.seq;
+	memcpy(msg->copies, dtn_conf.copies, sizeof(msg->copies));
+	msg->packet_delay = (uint32_t) dtn_conf.packet_delay * 1000 / CLOCK_SECOND;
+	msg->queue_delay = (uint32_t) dtn_conf.queue_delay * 1000 / CLOCK_SECOND;
+	msg->handoff_wait = (uint32_t) dtn_conf.handoff_wait * 1000 / CLOCK_SECOND;
+	msg->max_lifetime = dtn_conf.max_lifetime / CLOCK_SECOND;
+	msg->max_transmissions = dtn_conf.max_transmissions;
+	packetbuf_set_datalen(sizeof(struct dtn_config_msg));
 	broadcast_send(&dtn_chan.bc);
-	
-	//@todo check which is most expensive calling function or creating new variable for delay?
-	if(next_item->next == NULL){
-		//Reset Timer
-		ctimer_set(&dtn_global.local_ctimer, DTN_QUEUE_DELAY, broadcast_next, &dtn_global.pkt_last_sent);
+}
+
+/**
+ * @brief Handle a configuration received.
+ * @details Handle a configuration received. A newer one is taken and passed on, an older one is answered 
+ *          with the current one. A node that never had its configuration changed takes any.
+ */
+static void
+config_recv(){
+	struct dtn_config_msg *msg = (struct dtn_config_msg*) packetbuf_dataptr();
+	struct dtn_config conf;
+
+	if(msg->seq == dtn_conf.seq){
+		return;
+	}
+	//Neighbour is behind
+	if(msg->seq == 0 || (dtn_conf.seq != 0 && (int8_t)(msg->seq - dtn_conf.seq) < 0)){
+		dtn_global.config_pending = 1;
+		return;
+	}
+
+	//Checked before the ticks are cut to clock_time_t, a 16 bit clock only holds a few minutes
+	if((uint32_t) msg->packet_delay * CLOCK_SECOND / 1000 > DTN_CLOCK_HALF || 
+		(uint32_t) msg->queue_delay * CLOCK_SECOND / 1000 > DTN_CLOCK_HALF || 
+		(uint32_t) msg->handoff_wait * CLOCK_SECOND / 1000 > DTN_CLOCK_HALF || 
+		(uint32_t) msg->max_lifetime * CLOCK_SECOND > DTN_LIFETIME_CAP){
+		return;
+	}
+	conf.seq = msg->seq;
+	memcpy(conf.copies, msg->copies, sizeof(conf.copies));
+	conf.packet_delay = (uint32_t) msg->packet_delay * CLOCK_SECOND / 1000;
+	conf.queue_delay = (uint32_t) msg->queue_delay * CLOCK_SECOND / 1000;
+	conf.handoff_wait = (uint32_t) msg->handoff_wait * CLOCK_SECOND / 1000;
+	conf.max_lifetime = (clock_time_t) msg->max_lifetime * CLOCK_SECOND;
+	conf.max_transmissions = msg->max_transmissions;
+	if(config_valid(&conf) == 0){
+		return;
+	}
+	DEBUG_MSG(2, "NEW CONFIGURATION! SEQ: ", &rimeaddr_node_addr);
+	memcpy(&dtn_conf, &conf, sizeof(dtn_conf));
+	dtn_global.config_pending = 1;
+}
+
+
+/**
+ * @brief Pick the class of the next packet sprayed.
+ * @details Pick the class of the next packet sprayed. Weighted round robin, every class sprays up to 
+ *          its DTN_CLASS_*_WEIGHT packets in turn. A class with an empty queue is skipped.
+ * 
+ * @return The class. The queues must not all be empty.
+ */
+static uint8_t
+sched_pick(){
+	uint8_t i;
+
+	for(i = 0; i <= DTN_CLASSES; i++){
+		if(dtn_global.sched_credit > 0 && packetqueue_len(dtn_global.pkt_q[dtn_global.sched_class]) > 0){
+			dtn_global.sched_credit--;
+			break;
+		}
+		dtn_global.sched_class = (dtn_global.sched_class + 1) % DTN_CLASSES;
+		dtn_global.sched_credit = dtn_class_weight[dtn_global.sched_class];
+	}
+	return dtn_global.sched_class;
+}
+
+/**
+ * @brief Handle queue broadcast when DTN_BATCH_SPRAY or DTN_OFFER_MODE is set.
+ * @details Handle queue broadcast when DTN_BATCH_SPRAY or DTN_OFFER_MODE is set. The classes are gone through 
+ *          in turn from the one picked by sched_pick(), so every class leads the batch as often as its 
+ *          DTN_CLASS_*_WEIGHT and a steady alarm load does not starve DTN_CLASS_BULK. In every class the packets start 
+ *          after the last one sent. Every packet worth spraying is added to the batch until 
+ *          DTN_BATCH_MAX_SIZE is reached, less one tombstone when tomb_pending is set. If the whole queue fitted a 
+ *          delay of DTN_QUEUE_DELAY is introduced else the rest of the queue is sent after DTN_SPRAY_GAP.
+ * 
+ * @param is_offer If 1 (True) only the headers are added, if 0 (False) header and data.
+ */
+static void
+broadcast_batch(uint8_t is_offer){
+	struct dtn_batch_header *b_hdr;
+	struct packetqueue_item *q_item;
+	struct queuebuf *q_buf;
+	struct dtn_msg_header *msg_hdr;
+	uint8_t *ptr;
+	uint16_t len;
+	uint16_t max_len = DTN_BATCH_MAX_SIZE;
+	uint16_t q_len;
+	int i;
+	int qLength;
+	clock_time_t delay = 0;
+	uint8_t is_empty;
+	uint16_t age;
+	uint8_t first;
+	uint8_t k;
+	uint8_t c;
+
+	//Keep room for a tombstone a neighbour needs, a full batch or offer must not crowd it out
+	if(dtn_global.tomb_pending == 1){
+		max_len -= sizeof(struct dtn_tombstone_header) + sizeof(struct dtn_tombstone);
+	}
+	packetbuf_clear();
+	b_hdr = (struct dtn_batch_header*) packetbuf_dataptr();
+	b_hdr->protocol.version = DTN_VERSION;
+	b_hdr->protocol.type = (is_offer == 1) ? 'O' : 'B';
+	b_hdr->num_packets = 0;
+	ptr = (uint8_t*) packetbuf_dataptr() + sizeof(struct dtn_batch_header);
+	len = sizeof(struct dtn_batch_header);
+
+	//Classes in turn from the weighted pick. An empty queue only sends tombstones
+	first = (dtn_q_size() > 0) ? sched_pick() : 0;
+	for(k = 0; k < DTN_CLASSES && delay == 0; k++){
+		c = (first + k) % DTN_CLASSES;
+		qLength = packetqueue_len(dtn_global.pkt_q[c]);
+		//Start after last packet sent
+		if(dtn_global.pkt_last_sent[c] == NULL || dtn_global.pkt_last_sent[c]->next == NULL){
+			q_item = packetqueue_first(dtn_global.pkt_q[c]);
+		} else {
+			q_item = dtn_global.pkt_last_sent[c]->next;
+		}
+
+		for(i = 0; i < qLength; i++){
+			q_buf = packetqueue_queuebuf(q_item);
+			msg_hdr = (struct dtn_msg_header*) queuebuf_dataptr(q_buf);
+			//queuebuf_datalen() returns an int but is never negative
+			q_len = (is_offer == 1) ? sizeof(struct dtn_msg_header) : (uint16_t) queuebuf_datalen(q_buf);
+
+			//Check L value if 0 do not send!!!
+			if(is_worth_spraying(msg_hdr) == 1){
+				//Batch Full! Rest is sent in next call
+				if(len + 1 + q_len > max_len){
+					delay = dtn_conf.packet_delay;
+					break;
+				}
+				*ptr = q_len;
+				memcpy(ptr + 1, msg_hdr, q_len);
+				//Header is not aligned in the batch
+				age = bundle_age(q_item);
+				memcpy(ptr + 1 + offsetof(struct dtn_msg_header, age), &age, sizeof(age));
+				ptr += 1 + q_len;
+				len += 1 + q_len;
+				b_hdr->num_packets += 1;
+				print_packetbuf(msg_hdr, (is_offer == 1) ? DTN_EV_OFFER : DTN_EV_SPRAY);
+			}
+
+			dtn_global.pkt_last_sent[c] = q_item;
+			q_item = (q_item->next == NULL) ? packetqueue_first(dtn_global.pkt_q[c]) : q_item->next;
+		}
+	}
+
+	//An empty batch is only sent to carry tombstones
+	is_empty = (b_hdr->num_packets == 0 && dtn_global.tomb_pending == 0);
+	packetbuf_set_datalen(len);
+	append_tombstones(DTN_BATCH_MAX_SIZE);
+	if(is_empty == 0){
+		DTN_STAT(sprays_sent);
+		broadcast_send(&dtn_chan.bc);
+	}
+	schedule_next((delay == 0) ? round_delay() : delay);
+}
+
+static void
+broadcast_next(void *p_item){ 
+	static struct packetqueue_item *next_item;
+	struct dtn_msg_header *msg_hdr;
+	clock_time_t delay = dtn_conf.packet_delay;
+	uint8_t c;
+#if DTN_FLASH_STORE == 1
+	flash_page_in();
+#endif
+	//Nobody around. Sleep until a beacon is heard
+	if(DTN_BEACONS == 1 && neighbours_present() == 0){
+		schedule_next(round_delay());
+		return;
+	}
+	//A configuration to pass on. The round goes on in the next call
+	if(dtn_global.config_pending == 1){
+		config_send();
+		schedule_next(delay);
+		return;
+	}
+	//If queue is empty nothing to bcast. Except tombstones a neighbour needs
+	if(dtn_q_size(dtn_global) <= 0){
+		if(dtn_global.tomb_pending == 1){
+			broadcast_batch(0);
+			return;
+		}
+		schedule_next(round_delay());
+		return;
+	}
+
+	if(DTN_OFFER_MODE == 1 || DTN_BATCH_SPRAY == 1){
+		broadcast_batch(DTN_OFFER_MODE);
+		return;
+	}
+
+	c = sched_pick();
+	//If packet has not benn sent yeath or end of queue
+	if(dtn_global.pkt_last_sent[c] == NULL || dtn_global.pkt_last_sent[c]->next == NULL){
+		next_item = packetqueue_first(dtn_global.pkt_q[c]);
 	} else {
-		//Reset Timer
-		ctimer_set(&dtn_global.local_ctimer, DTN_PACKET_DELAY, broadcast_next, &dtn_global.pkt_last_sent);
+		next_item = dtn_global.pkt_last_sent[c]->next;
+	}
+	//Round ends once as many packets as queued have been looked at
+	dtn_global.sched_sent += 1;
+	if(dtn_global.sched_sent >= dtn_q_size()){
+		dtn_global.sched_sent = 0;
+		delay = round_delay();
+	}
+	
+	msg_hdr = get_hdr_buff(next_item);
+	//Store Next Item. A skipped packet does not hold back the rest of the queue
+	dtn_global.pkt_last_sent[c] = next_item;
+	//Check L value if 0 do not send!!!
+	if(is_worth_spraying(msg_hdr) == 0){
+		//Immediately go to next calll
+		schedule_next(delay);
+		return;
+	}
+
+	//Load packet in buffer
+	if(load_pkt_item(next_item, 1) == 0){
+		//Immediately go to next calll
+		schedule_next(delay);
+		return;
 	}
+	((struct dtn_msg_header*) packetbuf_dataptr())->age = bundle_age(next_item);
+	//send broadcast
+	print_packetbuf(packetbuf_dataptr(), DTN_EV_SPRAY);
+	append_tombstones(DTN_BATCH_MAX_SIZE);
+	DTN_STAT(sprays_sent);
+	broadcast_send(&dtn_chan.bc);
 	
-	return;
+	//Reset Timer
+	schedule_next(delay);
 }
 /*------------------------------------- Callbacks --------------------------------*/
 
 /**
- * @brief Callback function called when Broadcast message is received.
- * @details Callback function called when Broadcast message is received. This checks that the broacast
+ * @brief Add the room left to a request in the buffer.
+ * @details Add the room left in the queue of every class after the header of a request in the buffer. 
+ *          A neighbour starting a Contact Session does not push more than this.
+ */
+static void
+append_room(){
+	struct dtn_request_room *room = (struct dtn_request_room*) ((uint8_t*) packetbuf_dataptr() + sizeof(struct dtn_msg_header));
+	uint16_t left;
+	uint8_t i;
+
+	for(i = 0; i < DTN_CLASSES; i++){
+		left = room_left(i);
+		room->room[i] = (left > 0xFF) ? 0xFF : left;
+	}
+	packetbuf_set_datalen(sizeof(struct dtn_msg_header) + sizeof(struct dtn_request_room));
+}
+
+/**
+ * @brief Handle a sprayed packet that is in the buffer.
+ * @details Handle a sprayed packet that is in the buffer. This checks that the packet
  *          is an actuall message from a Spray and Wait protocol, that is has not been received. If full
  *          the message is not added to the queue. Once the message is going to be kept a Unicast is sent.
  * 
- * @param broadcast_conn the connection of the broadcast.
  * @param from Address from whom the message was received.
  */
 static void
-recv_bcast(struct broadcast_conn *c, const rimeaddr_t *from){
+handle_spray(const rimeaddr_t *from){
 	struct dtn_msg_header *hdr = (struct dtn_msg_header*) packetbuf_dataptr();
 	struct dtn_msg_header *saved_hdr;
 	struct packetqueue_item *i_q;
 	struct queuebuf *saved_buf;
 	static rimeaddr_t esender, ereceiver;
 	uint16_t pkt_id;
-	
-	DEBUG_MSG(2, "- RCV_BCAST - BCAST RECEVIED!! -- FROM: ", from);
+
 	print_buf_no_hdr();
 
 	if(is_spray_wait(hdr) == 0){
+		DTN_STAT(drop_not_dtn);
 		return;
 	}
 
@@ -533,21 +2643,60 @@ recv_bcast(struct broadcast_conn *c, const rimeaddr_t *from){
 	rimeaddr_copy(&ereceiver, &hdr->ereceiver);
 	pkt_id = hdr->epacketid;
 
-	//Packet is searching for source! If not source Drop
+	//Already delivered! The destination still answers so the sender drops its copy
+	if(is_tombstone(pkt_id, &esender) == 1 && rimeaddr_cmp(&ereceiver, &rimeaddr_node_addr) == 0){
+		DEBUG_MSG(2, "- RCV_BCAST - ALREADY DELIVERED!! -- FROM: ", from);
+		dtn_global.tomb_pending = 1;
+		return;
+	}
+
+	//Too old! Not worth the airtime
+	if(hdr->age >= hdr->ttl && rimeaddr_cmp(&ereceiver, &rimeaddr_node_addr) == 0){
+		DEBUG_MSG(2, "- RCV_BCAST - END TO END LIFETIME OVER!! -- FROM: ", from);
+		DTN_STAT(expired);
+		return;
+	}
+
+	//Packet is searching for source! If not source Drop. The strategy tells which packets are wanted
 	//Or Sender was me!
-	if((hdr->num_copies == 1 && rimeaddr_cmp(&ereceiver, &rimeaddr_node_addr) == 0) ||
+	if((rimeaddr_cmp(&ereceiver, &rimeaddr_node_addr) == 0 && dtn_strategy.wants(hdr) == 0 && 
+			(DTN_ROLE == DTN_ROLE_STATIC || DTN_FERRY_CUSTODY == 0)) ||
 		rimeaddr_cmp(&esender, &rimeaddr_node_addr) == 1){
 		DEBUG_MSG(2, "- RCV_BCAST - COPY and NOT DESTINATION || I WAS SENDER!! -- FROM: ", from);
 		return;
 	}
 
+	//Offer for me! Request the data. Unless it could not be reassembled
+	if(rimeaddr_cmp(&ereceiver, &rimeaddr_node_addr) == 1 && is_hdr_only()){
+		//Already delivered! The tombstones sent next make the sender drop its copy, no handoff needed
+		if(is_tombstone(pkt_id, &esender) == 1){
+			DEBUG_MSG(2, "- RCV_BCAST - OFFER ALREADY DELIVERED!! -- FROM: ", from);
+			dtn_global.tomb_pending = 1;
+			return;
+		}
+		if(can_reassemble(hdr) == 0){
+			return;
+		}
+		remove_data_from_buf();
+		append_room();
+		print_packetbuf(packetbuf_dataptr(), DTN_EV_REQUEST);
+		DTN_STAT(requests_sent);
+		unicast_send(&dtn_chan.uc, from);
+		return;
+	}
+
 	//Message for me!
 	if(rimeaddr_cmp(&ereceiver, &rimeaddr_node_addr) == 1){
-		printf("- RCV_BCAST - MY PRECIOUS!! :) !! -- FROM: %d SENDER: %d \n", from->u8[0], esender.u8[0]);
+		//Not requested so it is sprayed again
+		if(deliver_buf(from) == 0){
+			return;
+		}
 		//Put header only in buffer
 		remove_data_from_buf();
+		append_room();
 		//Send Unicast
-		print_packetbuf(packetbuf_dataptr(), "request");
+		print_packetbuf(packetbuf_dataptr(), DTN_EV_REQUEST);
+		DTN_STAT(requests_sent);
 		unicast_send(&dtn_chan.uc, from);
 		
 		return;
@@ -561,30 +2710,280 @@ recv_bcast(struct broadcast_conn *c, const rimeaddr_t *from){
 		saved_hdr = (struct dtn_msg_header*) queuebuf_dataptr(saved_buf);
 		if(saved_hdr->num_copies > 0){
 			DEBUG_MSG(2, "- RCV_BCAST - EXIST with num_copies > 0!! -- FROM: ", from);
+			DTN_STAT(drop_held);
 			return;
 		}
 	}
+#if DTN_FLASH_STORE == 1
+	//Packet saved in flash
+	if(i_q == NULL && flash_find(pkt_id, &esender) >= 0){
+		DEBUG_MSG(2, "- RCV_BCAST - EXIST in flash!! -- FROM: ", from);
+		DTN_STAT(drop_held);
+		return;
+	}
+#endif
 
-	//Sorry Queue full! Drop msg
-	if(i_q == NULL && dtn_q_size() == MAX_QUEUE_PACKETS){
+	//Sorry Queue full! Drop msg. Unless a packet can be evicted once the handoff arrives
+	if(i_q == NULL && room_left(hdr->tclass) == 0 && evict_candidate(hdr->tclass, 0) == NULL){
+		DTN_STAT(drop_queue_full);
 		return;
 	}
 
-	//Not in Queue and queue not full!
-	if(i_q == NULL){
-		//Queue Received packet
-		queue_buf(1);
-		//Get new position
-		i_q = find_packet(pkt_id, &esender, &ereceiver);
+	//Not in Queue! Stage it until the handoff confirms copies. Offers have nothing to stage
+	if(i_q == NULL && is_hdr_only() == 0){
+		stage_buf(hdr);
 	}
-	
-	//Load Header
-	load_hdr_item(i_q, 0);
+
+	//Request with no copies. No Runic yeath! Carries the strategy metric instead
+	hdr->num_copies = (dtn_strategy.metric != NULL) ? dtn_strategy.metric(&ereceiver) : 0;
+	remove_data_from_buf();
+	append_room();
 	//Send Unicast 
-	print_packetbuf(packetbuf_dataptr(), "request");
+	print_packetbuf(hdr, DTN_EV_REQUEST);
+	DTN_STAT(requests_sent);
 	unicast_send(&dtn_chan.uc, from);
 }
 
+/**
+ * @brief Callback function called when a beacon is received.
+ * @details Callback function called when a beacon is received. The neighbour is remembered as around.
+ * 
+ * @param broadcast_conn the connection of the beacon.
+ * @param from Address from whom the beacon was received.
+ */
+static void
+recv_beacon(struct broadcast_conn *c, const rimeaddr_t *from){
+	struct dtn_beacon *beacon = (struct dtn_beacon*) packetbuf_dataptr();
+	struct dtn_contact *contact;
+
+	if(packetbuf_datalen() < sizeof(struct dtn_beacon) || beacon->protocol.version != DTN_VERSION || 
+			beacon->protocol.type != 'H'){
+		return;
+	}
+	DEBUG_MSG(2, "- RCV_BEACON - BEACON RECEVIED!! -- FROM: ", from);
+	//New neighbour! Spray again soon
+	if(contact_sprayed(from) == 1){
+		cadence_reset();
+	}
+	contact = contact_find(from);
+	contact->role = beacon->role;
+	contact->capacity = beacon->capacity;
+}
+
+/**
+ * @brief Callback function called when Broadcast message is received.
+ * @details Callback function called when Broadcast message is received. A Batch Spray is split and every
+ *          packet in it is loaded in the buffer and handled as if it was sprayed on its own.
+ * 
+ * @param broadcast_conn the connection of the broadcast.
+ * @param from Address from whom the message was received.
+ */
+static void
+recv_bcast(struct broadcast_conn *c, const rimeaddr_t *from){
+	static uint8_t batch[PACKETBUF_SIZE];
+	struct dtn_batch_header *b_hdr = (struct dtn_batch_header*) packetbuf_dataptr();
+	uint16_t len = packetbuf_datalen();
+	uint16_t pos;
+	uint8_t num_packets;
+	uint8_t num_valid;
+	uint8_t p_len;
+
+	DEBUG_MSG(2, "- RCV_BCAST - BCAST RECEVIED!! -- FROM: ", from);
+	//New neighbour! Spray again soon
+	if(contact_sprayed(from) == 1){
+		cadence_reset();
+	}
+
+	//Configuration pushed through the network
+	if(len >= sizeof(struct dtn_config_msg) && b_hdr->protocol.version == DTN_VERSION && b_hdr->protocol.type == 'C'){
+		config_recv();
+		return;
+	}
+
+	if(len < sizeof(struct dtn_batch_header) || is_batch(b_hdr) == 0){
+		//Tombstones follow the packet
+		if(len > sizeof(struct dtn_msg_header) && is_spray_wait((struct dtn_msg_header*) b_hdr) == 1){
+			p_len = sizeof(struct dtn_msg_header) + ((struct dtn_msg_header*) b_hdr)->data_len;
+			if(len > p_len){
+				read_tombstones((uint8_t*) packetbuf_dataptr() + p_len, len - p_len);
+				packetbuf_set_datalen(p_len);
+			}
+		}
+		handle_spray(from);
+		return;
+	}
+
+	//Buffer is overwritten by every packet handled
+	memcpy(batch, b_hdr, len);
+	num_packets = b_hdr->num_packets;
+	pos = sizeof(struct dtn_batch_header);
+	//Find where the tombstones start. Read first so delivered packets are not requested
+	//Every entry must hold a whole header, and its data in a batch, within the frame
+	for(num_valid = 0; num_valid < num_packets; num_valid++){
+		p_len = (pos < len) ? batch[pos] : 0;
+		if(pos + 1 + p_len > len || p_len < sizeof(struct dtn_msg_header) || (p_len != sizeof(struct dtn_msg_header) && 
+				p_len != sizeof(struct dtn_msg_header) + batch[pos + 1 + offsetof(struct dtn_msg_header, data_len)])){
+			break;
+		}
+		pos += 1 + p_len;
+	}
+	//Truncated or malformed batch. The entries before are handled, the rest and the tombstones are dropped
+	if(num_valid == num_packets){
+		read_tombstones(&batch[pos], len - pos);
+	} else {
+		DEBUG_MSG(2, "- RCV_BCAST - MALFORMED BATCH!! -- FROM: ", from);
+		DTN_STAT(drop_not_dtn);
+	}
+
+	num_packets = num_valid;
+	pos = sizeof(struct dtn_batch_header);
+	for(; num_packets > 0; num_packets--){
+		p_len = batch[pos];
+		packetbuf_copyfrom(&batch[pos + 1], p_len);
+		handle_spray(from);
+		pos += 1 + p_len;
+	}
+}
+
+/**
+ * @brief Number of copies to give with a handoff.
+ * @details Number of copies to give with a handoff. Given by the forwarding strategy from the copies 
+ *          kept once the handoffs waiting for an ACK are done. The destination gets all the copies. 
+ *          A ferry with room gets all the copies but one, or all of them with DTN_FERRY_CUSTODY.
+ * 
+ * @param packetqueue_item The packet to hand off.
+ * @param to The neighbour requesting the packet.
+ * @param metric The strategy metric sent with the request. 0 if there was no request.
+ * @return The number of copies or 0 if there is nothing to give.
+ */
+static uint16_t
+handoff_copies(struct packetqueue_item *item, const rimeaddr_t *to, uint16_t metric){
+	struct dtn_msg_header *hdr = get_hdr_buff(item);
+	uint16_t available = hdr->num_copies;
+	int i;
+
+	if(rimeaddr_cmp(&hdr->ereceiver, to) == 1){
+		return available;
+	}
+
+	for(i = 0; i < DTN_HANDOFF_SLOTS; i++){
+		if(dtn_chan.rc[i].in_use == 1 && dtn_chan.rc[i].epacketid == hdr->epacketid &&
+				rimeaddr_cmp(&dtn_chan.rc[i].esender, &hdr->esender) == 1){
+			available = dtn_strategy.kept(available, dtn_chan.rc[i].num_copies);
+		}
+	}
+	//Ferry! It carries the packet to many more nodes than a peer
+	if(DTN_ROLE == DTN_ROLE_STATIC && contact_is_ferry(to, 1) == 1){
+		return (DTN_FERRY_CUSTODY == 1) ? available : available - 1;
+	}
+
+	return dtn_strategy.copies(hdr, available, to, metric);
+}
+
+/**
+ * @brief Check if a handoff of the packet to the neighbour is waiting for an ACK.
+ * @details Check if a handoff of the packet to the neighbour is waiting for an ACK.
+ * 
+ * @param pkt_id The packet id
+ * @param esender The End Sender Address
+ * @param to The neighbour.
+ * @return integer if 0 (False) if 1 (True)
+ */
+static int
+is_in_flight(uint16_t pkt_id, const rimeaddr_t *esender, const rimeaddr_t *to){
+	int i;
+
+	for(i = 0; i < DTN_HANDOFF_SLOTS; i++){
+		if(dtn_chan.rc[i].in_use == 1 && rimeaddr_cmp(&dtn_chan.rc[i].to, to) == 1 &&
+				dtn_chan.rc[i].epacketid == pkt_id && rimeaddr_cmp(&dtn_chan.rc[i].esender, esender) == 1){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Send a handoff over a free handoff slot.
+ * @details Send a handoff over a free handoff slot. The slot is set to wait for the ACK.
+ * 
+ * @param dtn_handoff The handoff slot.
+ * @param packetqueue_item The packet to hand off.
+ * @param to The neighbour.
+ * @param given The number of copies given.
+ * @param with_data If 1 (True) the data is sent with the header, if 0 (False) the header only.
+ */
+static void
+send_handoff(struct dtn_handoff *ho, struct packetqueue_item *item, const rimeaddr_t *to, uint16_t given, uint8_t with_data){
+	struct dtn_msg_header *hdr = get_hdr_buff(item);
+
+	rimeaddr_copy(&ho->to, to);
+	rimeaddr_copy(&ho->esender, &hdr->esender);
+	ho->epacketid = hdr->epacketid;
+	ho->num_copies = given;
+
+	//Load Item
+	if(with_data == 1){
+		load_bundle_item(item);
+	} else {
+		load_hdr_item(item, 0);
+	}
+	((struct dtn_msg_header*) packetbuf_dataptr())->num_copies = given;
+	((struct dtn_msg_header*) packetbuf_dataptr())->age = bundle_age(item);
+	//Send runicast
+	print_packetbuf(packetbuf_dataptr(), DTN_EV_HANDOFF);
+	ho->in_use = (runicast_send(&ho->rc, to, dtn_conf.max_transmissions) != 0);
+	if(ho->in_use == 0){
+		ho->session = 0;
+		return;
+	}
+	//Only counted once on its way, the STATS lines report what went on the air
+	DTN_STAT(handoffs_sent);
+}
+
+/**
+ * @brief Hand off the next packet of a contact session.
+ * @details Hand off the next packet of a contact session. The queue is walked from the position reached
+ *          by the session and the first packet with copies to give is sent with its data, since 
+ *          the neighbour never requested it. Only as many packets of a class as the neighbour had room for 
+ *          in its request are pushed, a full neighbour would drop them after the ACK and the copies would be lost. 
+ *          The session ends once the end of the queue is reached.
+ * 
+ * @param dtn_handoff The handoff slot running the session.
+ */
+static void
+session_next(struct dtn_handoff *ho){
+	struct packetqueue_item *q_item = queue_first(0);
+	struct dtn_msg_header *hdr;
+	uint16_t given;
+	uint16_t pos;
+
+	//Neighbour has left. Do not hand off blindly
+	if(DTN_BEACONS == 1 && contact_present(&ho->to) == 0){
+		q_item = NULL;
+	}
+	for(pos = 0; q_item != NULL; q_item = queue_next(q_item), pos++){
+		if(pos < ho->next_pos){
+			continue;
+		}
+		hdr = get_hdr_buff(q_item);
+		//Do not send back to the End Sender. Nor to a neighbour with no room left
+		if(hdr->tclass >= DTN_CLASSES || ho->room[hdr->tclass] == 0 || rimeaddr_cmp(&hdr->esender, &ho->to) == 1 || 
+				is_in_flight(hdr->epacketid, &hdr->esender, &ho->to) == 1){
+			continue;
+		}
+		given = handoff_copies(q_item, &ho->to, 0);
+		if(given > 0){
+			ho->next_pos = pos + 1;
+			ho->room[hdr->tclass] -= 1;
+			send_handoff(ho, q_item, &ho->to, given, 1);
+			return;
+		}
+	}
+
+	DEBUG_MSG(2, "CONTACT SESSION DONE!! WITH: ", &ho->to);
+	ho->session = 0;
+}
+
 /**
  * @brief Callback when unicast is received.
  * @details Callback when unicast is received. When Unicast is received check if the item is still in the queue
@@ -598,12 +2997,19 @@ static void
 recv_unic(struct unicast_conn *c, const rimeaddr_t *from){
 	struct dtn_msg_header *hdr = (struct dtn_msg_header*) packetbuf_dataptr();
 	struct packetqueue_item *i_q;
+	struct dtn_handoff *ho;
+	uint16_t given;
+	uint8_t is_new;
+	int i;
 	DEBUG_MSG(1, "RECEVIED UNICAST!! -- FROM: ", from);
 	DEBUG_PKT(hdr, 2);
 
 	if(is_spray_wait(hdr) == 0){
+		DTN_STAT(drop_not_dtn);
 		return;
 	}
+	DTN_STAT(requests_recv);
+	dtn_global.responded = 1;
 
 	i_q = find_packet(hdr->epacketid, &hdr->esender, &hdr->ereceiver);
 	//Packet might have been removed!
@@ -612,20 +3018,51 @@ recv_unic(struct unicast_conn *c, const rimeaddr_t *from){
 	}
 
 	//Packet received!! remove packet
-	if(rimeaddr_cmp(&hdr->ereceiver, from) == 1){
+	//In Offer Mode the destination is requesting the data. Removed once the handoff is ACKed.
+	if(rimeaddr_cmp(&hdr->ereceiver, from) == 1 && DTN_OFFER_MODE == 0){
 		DEBUG_MSG(3, "PACKET RECEVIED TO DESTINATION: ", &hdr->esender);	
+		//Drop the copy even if the tombstone already knew it
 		dtn_remove_queued_packet(i_q);
+		add_tombstone(hdr->epacketid, &hdr->esender);
 		print_q();
 		return;
 	}
 	
-	//Load Item
-	load_hdr_item(i_q, 1);
-	//Tmp store packetqueue item
-	dtn_global.sent_runicast = i_q;
-	//Send runicast
-	print_packetbuf(packetbuf_dataptr(), "handoff");
-	runicast_send(&dtn_chan.rc, from, DTN_MAX_TRANSMISSIONs);
+	is_new = contact_heard(from);
+	if(is_new == 1){
+		cadence_reset();
+	}
+
+	given = handoff_copies(i_q, from, hdr->num_copies);
+	if(given == 0 || is_in_flight(hdr->epacketid, &hdr->esender, from) == 1){
+		return;
+	}
+	//Weak link! Keep the copies for a neighbour that can be reached
+	if(rimeaddr_cmp(&hdr->ereceiver, from) == 0 && contact_link_ok(from) == 0){
+		DEBUG_MSG(2, "LINK TOO WEAK!! NO HANDOFF TO: ", from);
+		DTN_STAT(handoffs_skipped);
+		return;
+	}
+
+	//Find free slot. Requests from a Batch Spray arrive back to back.
+	for(ho = NULL, i = 0; i < DTN_HANDOFF_SLOTS && ho == NULL; i++){
+		if(dtn_chan.rc[i].in_use == 0 && runicast_is_transmitting(&dtn_chan.rc[i].rc) == 0){
+			ho = &dtn_chan.rc[i];
+		}
+	}
+	if(ho == NULL){
+		DEBUG_MSG(2, "ALL HANDOFF SLOTS BUSY!! DROP REQUEST FROM: ", from);
+		return;
+	}
+
+	//New neighbour! The rest of the queue follows this handoff, as far as the room it has
+	ho->session = (DTN_CONTACT_SESSION == 1 && is_new == 1);
+	ho->next_pos = 0;
+	memset(ho->room, 0, sizeof(ho->room));
+	if(packetbuf_datalen() >= sizeof(struct dtn_msg_header) + sizeof(struct dtn_request_room)){
+		memcpy(ho->room, (uint8_t*) hdr + sizeof(struct dtn_msg_header), sizeof(ho->room));
+	}
+	send_handoff(ho, i_q, from, given, DTN_OFFER_MODE);
 }
 
 /**
@@ -645,28 +3082,74 @@ recv_runic(struct runicast_conn *c, const rimeaddr_t *from, uint8_t seqno){
 	struct dtn_msg_header *saved_hdr;
 	struct packetqueue_item *i_q;
 	struct queuebuf *q_buf;
+	struct dtn_stage *st;
 
 	if(is_spray_wait(hdr) == 0){
+		DTN_STAT(drop_not_dtn);
+		return;
+	}
+	DTN_STAT(handoffs_recv);
+
+	//Offer Mode! Data received with the handoff
+	if(rimeaddr_cmp(&hdr->ereceiver, &rimeaddr_node_addr) == 1 && is_hdr_only() == 0){
+		deliver_buf(from);
+		return;
+	}
+
+	//Already delivered! Do not accept again. The tombstone tells the sender to drop its copy
+	if(is_tombstone(hdr->epacketid, &hdr->esender) == 1){
+		dtn_global.tomb_pending = 1;
 		return;
 	}
 
 	i_q = find_packet(hdr->epacketid, &hdr->esender, &hdr->ereceiver);
-	if(i_q == NULL || hdr->num_copies <= 0){
+	if(hdr->num_copies <= 0){
+		return;
+	}
+
+	//Offer Mode! Not queued yeath. Queue with the copies given
+	if(i_q == NULL && is_hdr_only() == 0){
+		if(make_room(hdr->tclass, 0) == 1){
+			enqueue_buf(hdr, calculate_max_lifetime(hdr->num_copies));
+		} else {
+			DTN_STAT(drop_queue_full);
+		}
+		return;
+	}
+
+	//Staged! Copies confirmed, now it takes a queue slot
+	if(i_q == NULL && is_hdr_only() == 1){
+		st = stage_find(hdr->epacketid, &hdr->esender);
+		if(st == NULL){
+			return;
+		}
+		if(make_room(hdr->tclass, 0) == 1){
+			stage_commit(st, hdr->num_copies);
+		} else {
+			DTN_STAT(drop_queue_full);
+		}
+		return;
+	}
+
+	if(i_q == NULL){
 		return;
 	}
 
 	q_buf = packetqueue_queuebuf(i_q);
 	//Convert buff to header
 	saved_hdr = (struct dtn_msg_header*) queuebuf_dataptr(q_buf);	
-	saved_hdr->num_copies =  hdr->num_copies;
-	//Overwritten timer to extend time!!
-	ctimer_set(&i_q->lifetimer, calculate_max_lifetime(saved_hdr->num_copies), dtn_remove_queued_packet, i_q);
+	//Placeholder has 0 copies. A Contact Session might hand off a packet already held, the copies must not wrap
+	saved_hdr->num_copies = ((uint16_t) saved_hdr->num_copies + hdr->num_copies > 0xFF) ? 0xFF : 
+		saved_hdr->num_copies + hdr->num_copies;
+	//Extend time!!
+	set_lifetime(i_q, calculate_max_lifetime(saved_hdr->num_copies));
 }
 
 /**
  * @brief Callback when Reliable Unicast is Received Successfull.
  * @details Callback when Reliable Unicast is Received Successfull. When this message is received
- *          Half the local Numebr of Copies.
+ *          the copies given are taken from the local Number of Copies. The handoff slot tells which packet
+ *          has been ACKed.
  * 
  * @param runicast_conn Runicast Connection
  * @param from Address with the receiving Address
@@ -674,21 +3157,45 @@ recv_runic(struct runicast_conn *c, const rimeaddr_t *from, uint8_t seqno){
  */
 static void 
 sent_runic(struct runicast_conn *c, const rimeaddr_t *from, uint8_t retransmissions){
-	if(dtn_global.sent_runicast == NULL){
+	struct dtn_handoff *ho = (struct dtn_handoff*) c;
+	struct packetqueue_item *i_q;
+	struct dtn_msg_header *saved_hdr;
+
+	if(ho->in_use == 0){
 		return;
 	}
+	ho->in_use = 0;
 
 	DEBUG_MSG(1, "SUCCESS: SENT RUNICAST TO: ", from);
-	struct packetqueue_item *i_q = dtn_global.sent_runicast;
-	struct queuebuf *q_buf;
-	struct dtn_msg_header *saved_hdr;
-
-	q_buf = packetqueue_queuebuf(i_q);
-	//Convert buff to header
-	saved_hdr = (struct dtn_msg_header*) queuebuf_dataptr(q_buf);
-	saved_hdr->num_copies = ceiling_divider(saved_hdr->num_copies, 2);
+	DTN_STAT(runic_acked);
+	DTN_STAT_ADD(runic_retransmissions, retransmissions);
+	i_q = find_packet_item(ho->epacketid, &ho->esender);
+	//Packet expired while waiting for ACK
+	if(i_q == NULL){
+		if(ho->session == 1){
+			session_next(ho);
+		}
+		return;
+	}
+	saved_hdr = get_hdr_buff(i_q);
+
+	//Offer Mode or Contact Session! The destination got the data
+	if(rimeaddr_cmp(&saved_hdr->ereceiver, from) == 1){
+		DEBUG_MSG(3, "PACKET RECEVIED TO DESTINATION: ", &ho->esender);
+		add_tombstone(ho->epacketid, &ho->esender);
+	} else if(DTN_FERRY_CUSTODY == 1 && ho->num_copies >= saved_hdr->num_copies && contact_is_ferry(from, 0) == 1){
+		//The ferry took custody
+		DEBUG_MSG(3, "CUSTODY TAKEN BY FERRY: ", from);
+		dtn_remove_queued_packet(i_q);
+	} else {
+		//Keep the copies not given
+		saved_hdr->num_copies = dtn_strategy.kept(saved_hdr->num_copies, ho->num_copies);
+	}
 
 	print_q();
+	if(ho->session == 1){
+		session_next(ho);
+	}
 }
 
 /**
@@ -696,7 +3203,8 @@ sent_runic(struct runicast_conn *c, const rimeaddr_t *from, uint8_t retransmissi
 */
 /**
  * @brief Callback when Reliable Unicast fails.
- * @details Callback when Reliable Unicast fails. Do nothing
+ * @details Callback when Reliable Unicast fails. The handoff slot is freed and the copies are kept.
+ *          A contact session on the slot ends.
  * 
  * @param runicast_conn Reliable Unocast Connection
  * @param from Address that failed
@@ -705,63 +3213,374 @@ sent_runic(struct runicast_conn *c, const rimeaddr_t *from, uint8_t retransmissi
 static void 
 timedout_runic(struct runicast_conn *c, const rimeaddr_t *from, uint8_t retransmissions){
 	DEBUG_MSG(1, "RUNICAST TIMEDOUT!! TO: ", from);
+	DTN_STAT(runic_timedout);
+	DTN_STAT_ADD(runic_retransmissions, retransmissions);
+	//Contact lost! The session ends
+	((struct dtn_handoff*) c)->in_use = 0;
+	((struct dtn_handoff*) c)->session = 0;
+}
+
+/*------------------------------------- Energy -----------------------------------*/
+#if DTN_STATS == 1 && DTN_ENERGEST == 1
+/**
+ * @brief Read the Energest times.
+ * @details Read the Energest times. The running times are flushed first.
+ * 
+ * @param dtn_energy Where the times are saved.
+ */
+static void
+energy_read(struct dtn_energy *e){
+	energest_flush();
+	e->cpu = energest_type_time(ENERGEST_TYPE_CPU);
+	e->tx = energest_type_time(ENERGEST_TYPE_TRANSMIT);
+	e->rx = energest_type_time(ENERGEST_TYPE_LISTEN);
+}
+
+/**
+ * @brief Add the time spent since a reading to an operation.
+ * @details Add the time spent since a reading to an operation. With a Duty Cycled MAC the frames are sent  
+ *          after the callback returns, that time is only in the total.
+ * 
+ * @param op The operation. One of DTN_OP_*.
+ * @param dtn_energy The reading taken when the operation started.
+ */
+static void
+energy_add(uint8_t op, const struct dtn_energy *start){
+	struct dtn_energy now;
+
+	energy_read(&now);
+	dtn_stat.energy[op].cpu += now.cpu - start->cpu;
+	dtn_stat.energy[op].tx += now.tx - start->tx;
+	dtn_stat.energy[op].rx += now.rx - start->rx;
+	dtn_stat.energy[op].calls += 1;
+}
+
+/**
+ * @brief Convert a time to energy.
+ * @details Convert a time to energy. Split in seconds and ticks so it does not overflow. 64 bit as 
+ *          a radio listening at a few tens of mW passes 2^32 uJ within a day.
+ * 
+ * @param ticks The time in RTIMER_SECOND ticks.
+ * @param power The power in uW.
+ * @return The energy in uJ.
+ */
+static uint64_t
+energy_uj(uint32_t ticks, uint32_t power){
+	return (uint64_t) (ticks / RTIMER_SECOND) * power + (uint64_t) (ticks % RTIMER_SECOND) * power / RTIMER_SECOND;
+}
+
+static void
+broadcast_next_metered(void *p_item){
+	struct dtn_energy start;
+
+	energy_read(&start);
+	broadcast_next(p_item);
+	energy_add(DTN_OP_SPRAY, &start);
+}
+
+static void
+recv_bcast_metered(struct broadcast_conn *c, const rimeaddr_t *from){
+	struct dtn_energy start;
+
+	energy_read(&start);
+	recv_bcast(c, from);
+	energy_add(DTN_OP_RECV_SPRAY, &start);
+}
+
+static void
+recv_unic_metered(struct unicast_conn *c, const rimeaddr_t *from){
+	struct dtn_energy start;
+
+	energy_read(&start);
+	recv_unic(c, from);
+	energy_add(DTN_OP_RECV_REQUEST, &start);
+}
+
+static void
+recv_runic_metered(struct runicast_conn *c, const rimeaddr_t *from, uint8_t seqno){
+	struct dtn_energy start;
+
+	energy_read(&start);
+	recv_runic(c, from, seqno);
+	energy_add(DTN_OP_RECV_HANDOFF, &start);
 }
 
+static void
+sent_runic_metered(struct runicast_conn *c, const rimeaddr_t *from, uint8_t retransmissions){
+	struct dtn_energy start;
+
+	energy_read(&start);
+	sent_runic(c, from, retransmissions);
+	energy_add(DTN_OP_ACKED, &start);
+}
+#endif
 /*--------------------------------------------------------------------------------*/
 
 //Initialize Callbacks
-static const struct broadcast_callbacks dtn_bcast_call = {recv_bcast};
-static const struct unicast_callbacks dtn_unic_call = {recv_unic};
+static const struct broadcast_callbacks dtn_bcast_call = {DTN_METERED(recv_bcast)};
+static const struct broadcast_callbacks dtn_beacon_call = {recv_beacon};
+static const struct unicast_callbacks dtn_unic_call = {DTN_METERED(recv_unic)};
 static const struct runicast_callbacks dtn_runic_call = {
-				recv_runic,
-				sent_runic,
+				DTN_METERED(recv_runic),
+				DTN_METERED(sent_runic),
 				timedout_runic
 			};
 
 /*--------------------------- Main Functions --------------------------------------*/
 
 void 
-dtn_init(){
+dtn_init(const struct dtn_callbacks *callbacks){
+	int i;
+
 	//Open Channels
 	broadcast_open(&dtn_chan.bc, DTN_BCAST_CHANNEL, &dtn_bcast_call);
 	unicast_open(&dtn_chan.uc, DTN_UNIC_CHANNEL, &dtn_unic_call);
-	runicast_open(&dtn_chan.rc, DTN_RUNIC_CHANNEL, &dtn_runic_call);
+	for(i = 0; i < DTN_HANDOFF_SLOTS; i++){
+		runicast_open(&dtn_chan.rc[i].rc, DTN_RUNIC_CHANNEL + i, &dtn_runic_call);
+		dtn_chan.rc[i].in_use = 0;
+		dtn_chan.rc[i].session = 0;
+	}
+	memset(dtn_contacts, 0, sizeof(dtn_contacts));
+	if(dtn_strategy.init != NULL){
+		dtn_strategy.init();
+	}
+	if(DTN_BEACONS == 1){
+		broadcast_open(&dtn_chan.beacon, DTN_BEACON_CHANNEL, &dtn_beacon_call);
+		ctimer_set(&dtn_global.beacon_ctimer, random_rand() % DTN_BEACON_INTERVAL, beacon_send, NULL);
+	}
+#if DTN_TRACE == DTN_TRACE_RING
+	dtn_trace_next = 0;
+	dtn_trace_count = 0;
+#if DTN_TRACE_DRAIN == 1
+	process_start(&dtn_trace_process, NULL);
+#endif
+#endif
+	//Default configuration
+	dtn_conf.seq = 0;
+	memcpy(dtn_conf.copies, dtn_class_copies, sizeof(dtn_conf.copies));
+	dtn_conf.packet_delay = DTN_SPRAY_GAP;
+	dtn_conf.queue_delay = DTN_QUEUE_DELAY;
+	dtn_conf.handoff_wait = DTN_HANDOFF_WAIT;
+	dtn_conf.max_lifetime = DTN_MAX_LIFETIME;
+	dtn_conf.max_transmissions = DTN_MAX_TRANSMISSIONs;
+	dtn_global.config_pending = 0;
+#if DTN_STATS == 1
+	memset(&dtn_stat, 0, sizeof(dtn_stat));
+#if DTN_ENERGEST == 1
+	energy_read(&dtn_energy_start);
+#endif
+#endif
 
 	//Initialize Packet Queue
+  	packetqueue_init(&pkt_q_alarm);
   	packetqueue_init(&pkt_q);
+  	packetqueue_init(&pkt_q_bulk);
+  	//Initialize Bundle Index
+  	memb_init(&dtn_index_memb);
+  	memb_init(&dtn_stage_memb);
+  	list_init((list_t) &dtn_stage_list);
+  	for(i = 0; i < DTN_INDEX_BUCKETS; i++){
+  		list_init((list_t) &dtn_index[i]);
+  	}
   	//Start struct
   	dtn_global.pkt_seq_no = 0;
-  	dtn_global.pkt_q = &pkt_q;
-  	dtn_global.pkt_last_sent = NULL;
-  	dtn_global.sent_runicast = NULL;
+  	//The epoch takes the bits of the id above the sequence number
+#if DTN_EPOCH_STORE == 1
+  	dtn_global.epoch = flash_next_epoch() & (0xFFFF >> DTN_ID_SEQ_BITS);
+#else
+  	//Not kept, the IDs of the last boot are reused. See DTN_EPOCH_STORE
+  	dtn_global.epoch = 0;
+#endif
+  	dtn_global.pkt_q[DTN_CLASS_ALARM] = &pkt_q_alarm;
+  	dtn_global.pkt_q[DTN_CLASS_TELEMETRY] = &pkt_q;
+  	dtn_global.pkt_q[DTN_CLASS_BULK] = &pkt_q_bulk;
+  	for(i = 0; i < DTN_CLASSES; i++){
+  		dtn_global.pkt_last_sent[i] = NULL;
+  	}
+  	dtn_global.sched_class = DTN_CLASSES - 1;
+  	dtn_global.sched_credit = 0;
+  	dtn_global.sched_sent = 0;
+  	dtn_global.expiry_list = NULL;
+  	dtn_global.tomb_next = 0;
+  	dtn_global.tomb_count = 0;
+  	dtn_global.tomb_pending = 0;
+  	dtn_global.callbacks = callbacks;
+  	dtn_global.flash_next = 0;
+  	dtn_global.flash_read = 0;
+#if DTN_FLASH_STORE == 1
+  	flash_recover();
+#endif
+  	dtn_reasm.in_use = 0;
+  	dtn_agg.len = 0;
   	//Start broadcasting in number of QUEUE DELAY
-  	ctimer_set(&dtn_global.local_ctimer, DTN_QUEUE_DELAY, broadcast_next, &dtn_global.pkt_last_sent);
+  	dtn_global.cadence = DTN_CADENCE_MIN;
+  	dtn_global.responded = 0;
+  	schedule_next(dtn_conf.queue_delay);
 }
 
 void
 dtn_close(){
+	int i;
+
+	ctimer_stop(&dtn_agg.ctimer);
 	broadcast_close(&dtn_chan.bc);
+	if(DTN_BEACONS == 1){
+		ctimer_stop(&dtn_global.beacon_ctimer);
+		broadcast_close(&dtn_chan.beacon);
+	}
 	unicast_close(&dtn_chan.uc);
-	runicast_close(&dtn_chan.rc);
+	for(i = 0; i < DTN_HANDOFF_SLOTS; i++){
+		runicast_close(&dtn_chan.rc[i].rc);
+	}
 }
 
 int
 dtn_q_size(){
-	return packetqueue_len(dtn_global.pkt_q);
+	return packetqueue_len(dtn_global.pkt_q[DTN_CLASS_ALARM]) + packetqueue_len(dtn_global.pkt_q[DTN_CLASS_TELEMETRY]) + 
+		packetqueue_len(dtn_global.pkt_q[DTN_CLASS_BULK]);
+}
+
+const struct dtn_stats
+*dtn_stats(){
+#if DTN_STATS == 1
+#if DTN_ENERGEST == 1
+	energy_read(&dtn_stat.energy_total);
+	dtn_stat.energy_total.cpu -= dtn_energy_start.cpu;
+	dtn_stat.energy_total.tx -= dtn_energy_start.tx;
+	dtn_stat.energy_total.rx -= dtn_energy_start.rx;
+	dtn_stat.energy_per_delivered = (energy_uj(dtn_stat.energy_total.cpu, DTN_POWER_CPU) + 
+		energy_uj(dtn_stat.energy_total.tx, DTN_POWER_TX) + energy_uj(dtn_stat.energy_total.rx, DTN_POWER_RX)) / 
+		((dtn_stat.delivered_own > 0) ? dtn_stat.delivered_own : 1);
+#endif
+	return &dtn_stat;
+#else
+	return NULL;
+#endif
+}
+
+uint16_t
+dtn_new_buff(const void *data, uint16_t len, const rimeaddr_t *destination, uint8_t tclass){
+	uint16_t id;
+	uint8_t frag_total;
+	uint8_t frag_len;
+	uint8_t i;
+	struct packetqueue_item *item;
+
+	//Bound first, the number of fragments of a longer payload does not fit
+	if(len == 0 || len > DTN_MAX_FRAGS * DTN_FRAG_SIZE || tclass >= DTN_CLASSES){
+		return DTN_NO_ID;
+	}
+	frag_total = (len + DTN_FRAG_SIZE - 1) / DTN_FRAG_SIZE;
+	if(frag_total > dtn_class_size[tclass]){
+		return DTN_NO_ID;
+	}
+	//All fragments or none
+	if(DTN_EVICT_POLICY == DTN_EVICT_NONE && room_left(tclass) < frag_total){
+		DTN_STAT(drop_queue_full);
+		return DTN_NO_ID;
+	}
+	//The fragments IDs must not wrap. The first fragment is found as epacketid - frag_index
+	//The last sequence number is not used so DTN_NO_ID is never given. A new epoch so the wrap does not reuse IDs
+	if(dtn_global.pkt_seq_no + frag_total > DTN_ID_SEQ_MASK){
+		dtn_global.pkt_seq_no = 0;
+		epoch_advance();
+	}
+	id = ((uint16_t) dtn_global.epoch << DTN_ID_SEQ_BITS) | dtn_global.pkt_seq_no;
+
+	for(i = 0; i < frag_total; i++){
+		if(make_room(tclass, 1) == 0){
+			DTN_STAT(drop_queue_full);
+			break;
+		}
+		frag_len = (len - i * DTN_FRAG_SIZE > DTN_FRAG_SIZE) ? DTN_FRAG_SIZE : len - i * DTN_FRAG_SIZE;
+		//Create new buffer
+		//Data Buffer
+		create_buf_data((const uint8_t*) data + i * DTN_FRAG_SIZE, frag_len);
+		//Header Buffer
+		create_buf_hdr(destination, frag_len, i, frag_total, tclass);
+		//Print Buffer
+		print_buf_with_hdr();
+		//Queue newly created record
+		if(queue_buf(0) == 0){
+			break;
+		}
+	}
+	if(i == frag_total){
+		return id;
+	}
+	//All fragments or none. Take back the ones queued
+	while(i-- > 0){
+		item = find_packet_item(id + i, &rimeaddr_node_addr);
+		if(item != NULL){
+			dtn_remove_queued_packet(item);
+		}
+	}
+	return DTN_NO_ID;
+}
+
+/**
+ * @brief Seal the open bundle.
+ * @details Seal the open bundle and queue it. Called when DTN_AGGREGATE_DELAY passed.
+ * 
+ * @param ptr Not used.
+ */
+static void
+aggregate_seal(void *ptr){
+	uint8_t len = dtn_agg.len;
+
+	ctimer_stop(&dtn_agg.ctimer);
+	if(len == 0){
+		return;
+	}
+	dtn_agg.len = 0;
+	dtn_new_buff(dtn_agg.data, len, &dtn_agg.ereceiver, dtn_agg.tclass);
+}
+
+void
+dtn_get_config(struct dtn_config *conf){
+	memcpy(conf, &dtn_conf, sizeof(dtn_conf));
+}
+
+int
+dtn_set_config(const struct dtn_config *conf){
+	uint8_t seq = dtn_conf.seq + 1;
+
+	if(config_valid(conf) == 0){
+		return 0;
+	}
+	memcpy(&dtn_conf, conf, sizeof(dtn_conf));
+	//0 is kept for a configuration never changed
+	dtn_conf.seq = (seq == 0) ? 1 : seq;
+	dtn_global.config_pending = 1;
+	return 1;
+}
+
+int
+dtn_append(const void *data, uint8_t len, const rimeaddr_t *destination, uint8_t tclass){
+	if(len == 0 || len > DTN_AGGREGATE_SIZE || tclass >= DTN_CLASSES){
+		return 0;
+	}
+	//Does not belong to the open bundle
+	if(dtn_agg.len > 0 && (dtn_agg.len + len > DTN_AGGREGATE_SIZE || dtn_agg.tclass != tclass || 
+			rimeaddr_cmp(&dtn_agg.ereceiver, destination) == 0)){
+		aggregate_seal(NULL);
+	}
+	//Open a new bundle
+	if(dtn_agg.len == 0){
+		rimeaddr_copy(&dtn_agg.ereceiver, destination);
+		dtn_agg.tclass = tclass;
+		ctimer_set(&dtn_agg.ctimer, DTN_AGGREGATE_DELAY, aggregate_seal, NULL);
+	}
+	memcpy(dtn_agg.data + dtn_agg.len, data, len);
+	dtn_agg.len += len;
+	//Full
+	if(dtn_agg.len == DTN_AGGREGATE_SIZE){
+		aggregate_seal(NULL);
+	}
+	return 1;
 }
 
 void
-dtn_new_buff(struct dtn_msg_data *data, const rimeaddr_t *destination){
-	if(dtn_q_size() == MAX_QUEUE_PACKETS){
-		return;
-	}
-	//Create new buffer
-	//Data Buffer
-	create_buf_data(data);
-	//Header Buffer
-	create_buf_hdr(destination);
-	//Print Buffer
-	print_buf_with_hdr();
-	//Queue newly created record
-	queue_buf(0);
-}
\ No newline at end of file
+dtn_flush(){
+	aggregate_seal(NULL);
+}
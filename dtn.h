@@ -6,35 +6,279 @@
  */
 
 #include "net/rime.h"
-#include <math.h>
+
+/**
+ * @brief	Packs the structures sent over the air. No padding is sent.
+ */
+#ifdef __GNUC__
+#define DTN_PACKED __attribute__((packed))
+#else
+#define DTN_PACKED
+#endif
+/*
+ * The 16 bit fields of the headers are sent little endian, the byte order of the supported motes. 
+ * They are read in place from the buffers so a big endian host would not understand the others.
+ */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#error "DTN headers are little endian on the air"
+#endif
 /**
  * @brief	Broadcast Channel - Spray Message
  */
 #define DTN_BCAST_CHANNEL 128
+/**
+ * @brief	Beacon Channel - Neighbour Discovery. Only used when DTN_BEACONS is set.
+ */
+#define DTN_BEACON_CHANNEL DTN_BCAST_CHANNEL-1
 /**
  * @brief	Unicast Channel - Handle Spray Message Notification
  */
 #define DTN_UNIC_CHANNEL DTN_BCAST_CHANNEL+1
 /**
- * @brief	Reliable Unicast Channel - L Message Propogation
+ * @brief	Reliable Unicast Channel - L Message Propogation. 
+ *       	The first of DTN_HANDOFF_SLOTS channels, one for every handoff slot.
  */
 #define DTN_RUNIC_CHANNEL DTN_UNIC_CHANNEL+1
 /**
- * @brief	The Queue Size Limit
+ * @brief	Max Number of handoffs waiting for an ACK at the same time.
+ */
+#define DTN_HANDOFF_SLOTS 3
+/**
+ * @brief	The Queue Size Limit. Size of the queue of DTN_CLASS_TELEMETRY. Can be set from the build with DTN_CONF_QUEUE_PACKETS.
  */
+#ifdef DTN_CONF_QUEUE_PACKETS
+#define MAX_QUEUE_PACKETS DTN_CONF_QUEUE_PACKETS
+#else
 #define MAX_QUEUE_PACKETS 5
+#endif
+/**
+ * @brief	Traffic Classes. Every class has its own queue, number of copies and share of the sprays.
+ *       	- DTN_CLASS_ALARM: Urgent packets.
+ *       	- DTN_CLASS_TELEMETRY: Routine packets.
+ *       	- DTN_CLASS_BULK: Packets that can wait.
+ */
+#define DTN_CLASS_ALARM 0
+#define DTN_CLASS_TELEMETRY 1
+#define DTN_CLASS_BULK 2
+#define DTN_CLASSES 3
+/**
+ * @brief	Queue size of the classes. DTN_CLASS_TELEMETRY holds MAX_QUEUE_PACKETS.
+ */
+#define DTN_CLASS_ALARM_PACKETS 2
+#define DTN_CLASS_BULK_PACKETS 2
+/**
+ * @brief	Number of packets all queues hold together.
+ */
+#define DTN_QUEUED_PACKETS (DTN_CLASS_ALARM_PACKETS + MAX_QUEUE_PACKETS + DTN_CLASS_BULK_PACKETS)
+/**
+ * @brief	Number of L Copies a packet of the class is created with. DTN_CLASS_TELEMETRY uses DTN_L_COPIES.
+ */
+#define DTN_CLASS_ALARM_COPIES 16
+#define DTN_CLASS_BULK_COPIES 4
+/**
+ * @brief	Weights of the spray scheduler. A class sprays up to this many packets in turn. With DTN_BATCH_SPRAY 
+ *       	or DTN_OFFER_MODE a class leads up to this many batches in turn, the rest of the batch is filled by the 
+ *       	classes after it.
+ */
+#define DTN_CLASS_ALARM_WEIGHT 4
+#define DTN_CLASS_TELEMETRY_WEIGHT 2
+#define DTN_CLASS_BULK_WEIGHT 1
+/**
+ * @brief	Number of buckets in the bundle index. The power of 2 at or above half of DTN_QUEUED_PACKETS, at least 8, 
+ *       	so a bucket holds about 2 packets whatever the queue sizes.
+ */
+#define DTN_INDEX_POW2(n) ((n) <= 8 ? 8 : (n) <= 16 ? 16 : (n) <= 32 ? 32 : (n) <= 64 ? 64 : (n) <= 128 ? 128 : \
+	(n) <= 256 ? 256 : (n) <= 512 ? 512 : (n) <= 1024 ? 1024 : 2048)
+#define DTN_INDEX_BUCKETS DTN_INDEX_POW2(DTN_QUEUED_PACKETS / 2)
 /**
  * @brief	MAX Retransmission for Reliable Unicast
  */
 #define DTN_MAX_TRANSMISSIONs 3
 /**
- * @brief	Max Number of L Copies that can be distributed
+ * @brief	Eviction Policies. Used to make room for a new packet when the queue is full.
+ *       	- DTN_EVICT_NONE: No packet is evicted, the new packet is dropped.
+ *       	- DTN_EVICT_OLDEST: The packet queued the longest time ago is evicted.
+ *       	- DTN_EVICT_FEWEST_COPIES: The packet with the fewest copies left is evicted. Oldest first on a tie.
+ *       	- DTN_EVICT_WEIGHTED: The packet with the highest weighted score of age and copies given away is evicted.
+ */
+#define DTN_EVICT_NONE 0
+#define DTN_EVICT_OLDEST 1
+#define DTN_EVICT_FEWEST_COPIES 2
+#define DTN_EVICT_WEIGHTED 3
+/**
+ * @brief	The Eviction Policy used. NB: DTN_EVICT_NONE is the protocol specification.
+ */
+#define DTN_EVICT_POLICY DTN_EVICT_NONE
+/**
+ * @brief	Weights of the DTN_EVICT_WEIGHTED score. Per second queued and per copy given away.
  */
+#define DTN_EVICT_W_AGE 1
+#define DTN_EVICT_W_COPIES 8
+/**
+ * @brief	Protect locally created packets. If 1 they are only evicted to make room for a new local packet.
+ */
+#define DTN_EVICT_PROTECT_LOCAL 1
+/**
+ * @brief	Max Number of L Copies that can be distributed. Can be set from the build with DTN_CONF_L_COPIES.
+ */
+#ifdef DTN_CONF_L_COPIES
+#define DTN_L_COPIES DTN_CONF_L_COPIES
+#else
 #define DTN_L_COPIES 8
+#endif
+/**
+ * @brief	Forwarding Strategies. Decide which sprayed packets a relay asks for and how many copies a handoff gives.
+ *       	- DTN_STRATEGY_SPRAY_WAIT: Binary Spray and Wait. Half of the copies are given to every neighbour asking.
+ *       	- DTN_STRATEGY_SOURCE_SPRAY: Source Spray and Wait. Only the End Sender gives copies, one to every neighbour.
+ *       	- DTN_STRATEGY_EPIDEMIC: Capped Epidemic. Every node gives a copy to every neighbour and keeps its own. 
+ *       		The number of copies is the hop budget, the neighbour gets one less.
+ *       	- DTN_STRATEGY_PROPHET: PRoPHET. As Binary Spray and Wait but copies are only given to a neighbour 
+ *       		more likely to meet the End Receiver. The likelihood is learnt from the encounters.
+ */
+#define DTN_STRATEGY_SPRAY_WAIT 0
+#define DTN_STRATEGY_SOURCE_SPRAY 1
+#define DTN_STRATEGY_EPIDEMIC 2
+#define DTN_STRATEGY_PROPHET 3
+/**
+ * @brief	The Forwarding Strategy used. NB: DTN_STRATEGY_SPRAY_WAIT is the protocol specification.
+ */
+#define DTN_STRATEGY DTN_STRATEGY_SPRAY_WAIT
+/**
+ * @brief	Number of End Receivers DTN_STRATEGY_PROPHET keeps a delivery predictability for.
+ */
+#define DTN_PROPHET_ENTRIES 8
+/**
+ * @brief	PRoPHET constants. Predictabilities go from 0 to 255.
+ *       	- DTN_PROPHET_P_INIT: Part of the predictability missing added on every encounter, out of 255.
+ *       	- DTN_PROPHET_BETA: Weight of the transitive predictability, out of 256.
+ *       	- DTN_PROPHET_GAMMA: Ageing of the predictability per DTN_PROPHET_AGE_UNIT, out of 256.
+ */
+#define DTN_PROPHET_P_INIT 191
+#define DTN_PROPHET_BETA 64
+#define DTN_PROPHET_GAMMA 250
+#define DTN_PROPHET_AGE_UNIT 30*CLOCK_SECOND
 /**
  * @brief	Protocol Version Number
  */
-#define DTN_VERSION 1
+#define DTN_VERSION 8
+/**
+ * @brief	Number of bits of the packet ID holding the sequence number. The bits above hold the boot epoch,
+ *       	so a node that restarts does not reuse the IDs of the packets it sent before. The epoch also moves on 
+ *       	when the sequence number wraps. NB: The ID is 16 bits, after 256 epochs (restarts and wraps of 
+ *       	256 packets together) the IDs of the first epoch are given again. A node still holding tombstones 
+ *       	of them takes the new packets for delivered ones.
+ */
+#define DTN_ID_SEQ_BITS 8
+#define DTN_ID_SEQ_MASK ((1 << DTN_ID_SEQ_BITS) - 1)
+/**
+ * @brief	Returned by dtn_new_buff() if the message was not queued. Never given to a packet.
+ */
+#define DTN_NO_ID 0xFFFF
+/**
+ * @brief	Max payload carried by one packet. Bigger payloads are split in fragments of this size.
+ */
+#define DTN_FRAG_SIZE 48
+/**
+ * @brief	Max number of fragments of a payload. Every fragment takes a queue slot so it cannot be more than the queue size of its class.
+ */
+#define DTN_MAX_FRAGS 4
+/**
+ * @brief	Most bytes of readings dtn_append() puts in one bundle. One fragment, so the bundle is never split.
+ */
+#define DTN_AGGREGATE_SIZE DTN_FRAG_SIZE
+/**
+ * @brief	Time an open bundle of dtn_append() waits for more readings before it is sealed and queued.
+ */
+#define DTN_AGGREGATE_DELAY 5*CLOCK_SECOND
+/**
+ * @brief	Flash Store. If 1 packets overflowing the queue, and packets whose lifetime ended with copies left,
+ *       	are moved to a log on flash (CFS) instead of being lost. They are paged back into the queue when there
+ *       	is room. The store is recovered by dtn_init().
+ */
+#define DTN_FLASH_STORE 0
+/**
+ * @brief	Number of packets the Flash Store holds.
+ */
+#define DTN_FLASH_BUNDLES 32
+/**
+ * @brief	The files of the Flash Store. The log of packets and its index.
+ */
+#define DTN_FLASH_LOG "dtn.log"
+#define DTN_FLASH_INDEX "dtn.idx"
+/**
+ * @brief	Keep the boot epoch in a file (CFS) across restarts, even if DTN_FLASH_STORE is 0.
+ *       	If 0 every boot has epoch 0 and the IDs start again from 0. Nodes still holding tombstones
+ *       	of the old IDs take the new packets for delivered ones and drop them, until the sequence
+ *       	has moved past the tombstone window of DTN_TOMB_SPAN IDs.
+ */
+#define DTN_EPOCH_STORE 1
+/**
+ * @brief	Name of the file holding the boot epoch. Used with DTN_EPOCH_STORE.
+ */
+#define DTN_FLASH_EPOCH "dtn.ep"
+/**
+ * @brief	Keep the statistics counters returned by dtn_stats(). If 0 they are compiled out.
+ */
+#define DTN_STATS 1
+/**
+ * @brief	Energy accounting. If 1 the CPU, transmit and listen time spent in the protocol callbacks is read 
+ *       	from Energest and kept in the statistics per operation. Needs DTN_STATS and ENERGEST_CONF_ON.
+ */
+#define DTN_ENERGEST 0
+/**
+ * @brief	Operations of the energy accounting.
+ *       	- DTN_OP_SPRAY: A round step of the queue. broadcast_next().
+ *       	- DTN_OP_RECV_SPRAY: A spray, batch or offer received. recv_bcast().
+ *       	- DTN_OP_RECV_REQUEST: A request received. recv_unic().
+ *       	- DTN_OP_RECV_HANDOFF: A handoff received. recv_runic().
+ *       	- DTN_OP_ACKED: A handoff ACKed. sent_runic().
+ */
+#define DTN_OP_SPRAY 0
+#define DTN_OP_RECV_SPRAY 1
+#define DTN_OP_RECV_REQUEST 2
+#define DTN_OP_RECV_HANDOFF 3
+#define DTN_OP_ACKED 4
+#define DTN_OPS 5
+/**
+ * @brief	Power drawn in uW by the CPU, the radio transmitting and the radio listening. Used for the energy 
+ *       	per delivered packet. The defaults are for a Tmote Sky (MSP430 and CC2420) at 3 V.
+ */
+#define DTN_POWER_CPU 5400
+#define DTN_POWER_TX 52200
+#define DTN_POWER_RX 56400
+/**
+ * @brief	Tracing backends of the sent frames.
+ *       	- DTN_TRACE_OFF: Nothing is traced.
+ *       	- DTN_TRACE_TEXT: Every frame is printed before it is sent.
+ *       	- DTN_TRACE_RING: A binary record of every frame is kept in a RAM ring. 
+ *       		Read with dtn_trace_read() and printed as text with dtn_trace_print().
+ */
+#define DTN_TRACE_OFF 0
+#define DTN_TRACE_TEXT 1
+#define DTN_TRACE_RING 2
+/**
+ * @brief	The Tracing backend used. Can be set from the build with DTN_CONF_TRACE.
+ */
+#ifdef DTN_CONF_TRACE
+#define DTN_TRACE DTN_CONF_TRACE
+#else
+#define DTN_TRACE DTN_TRACE_TEXT
+#endif
+/**
+ * @brief	Number of records the trace ring holds. When full the oldest record is overwritten.
+ */
+#define DTN_TRACE_RECORDS 16
+/**
+ * @brief	If 1 a process prints the trace ring when the radio path is done. If 0 the ring is only read on demand.
+ */
+#define DTN_TRACE_DRAIN 1
+/**
+ * @brief	Frames traced.
+ */
+#define DTN_EV_SPRAY 0
+#define DTN_EV_OFFER 1
+#define DTN_EV_REQUEST 2
+#define DTN_EV_HANDOFF 3
 /**
  * @brief	Control Verbosaty of the Debug functions
  */
@@ -44,93 +288,669 @@
  */
 #define DTN_QUEUE_DELAY 3*CLOCK_SECOND
 /**
- * @brief	Delay incurred for next packet broadcast
+ * @brief	Delay incurred for next packet broadcast. Can be set from the build in milliseconds with DTN_CONF_PACKET_DELAY_MS.
  */
+#ifdef DTN_CONF_PACKET_DELAY_MS
+#define DTN_PACKET_DELAY ((clock_time_t)((uint32_t) DTN_CONF_PACKET_DELAY_MS * CLOCK_SECOND / 1000))
+#else
 #define DTN_PACKET_DELAY 1*CLOCK_SECOND
+#endif
+/**
+ * @brief	Duty Cycled MAC. 1 if the radio sleeps between channel checks (ContikiMAC, X-MAC). Set from the Makefile.
+ *       	The packets of a round are then sprayed in one burst DTN_SPRAY_GAP apart, so the radio is busy once
+ *       	a round and sleeps in between. The handoff timeouts allow for the latency of the MAC.
+ */
+#ifdef DTN_CONF_DUTY_CYCLE
+#define DTN_DUTY_CYCLE DTN_CONF_DUTY_CYCLE
+#else
+#define DTN_DUTY_CYCLE 0
+#endif
+/**
+ * @brief	Period of the channel checks of the MAC. A broadcast is repeated for a whole period, a unicast waits up to one.
+ */
+#ifdef NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE
+#define DTN_WAKE_INTERVAL (CLOCK_SECOND / NETSTACK_CONF_RDC_CHANNEL_CHECK_RATE)
+#else
+#define DTN_WAKE_INTERVAL (CLOCK_SECOND / 8)
+#endif
+/**
+ * @brief	Delay between the packets of a round. With a Duty Cycled MAC two wake intervals: one for the spray 
+ *       	and one for a request to come back.
+ */
+#define DTN_SPRAY_GAP ((DTN_DUTY_CYCLE == 1) ? 2 * DTN_WAKE_INTERVAL : DTN_PACKET_DELAY)
+/**
+ * @brief	Adaptive Cadence. If 1 the delay after every round of the queue doubles while no request comes back,
+ *       	up to DTN_CADENCE_MAX. It is reset to DTN_CADENCE_MIN when a new neighbour is heard or a packet is queued.
+ *       	Every delay is picked at random in its second half so neighbours do not spray at once (Trickle).
+ *       	If 0 the fixed DTN_QUEUE_DELAY is used.
+ */
+#define DTN_ADAPTIVE_CADENCE 0
+/**
+ * @brief	Shortest and longest delay after a round of the queue with the Adaptive Cadence.
+ */
+#define DTN_CADENCE_MIN DTN_QUEUE_DELAY
+#define DTN_CADENCE_MAX 64*CLOCK_SECOND
+/**
+ * @brief	Batch Spray. If 1 all queued packets that fit in DTN_BATCH_MAX_SIZE are sprayed in one broadcast.
+ *       	If 0 one packet is sprayed per broadcast.
+ */
+#define DTN_BATCH_SPRAY 0
+/**
+ * @brief	Max Number of bytes of a batch spray. Leaves room for the Rime and MAC headers.
+ */
+#define DTN_BATCH_MAX_SIZE 100
+/**
+ * @brief	Offer Mode. If 1 only the headers of the queued packets are sprayed, batched as in DTN_BATCH_SPRAY.
+ *       	The data is sent with the handoff once a neighbour requests the packet.
+ */
+#define DTN_OFFER_MODE 0
+/**
+ * @brief	Contact Session. If 1 the first request from a new neighbour starts a session that hands off
+ *       	every queued packet to the neighbour back to back over the handoff slot.
+ */
+#define DTN_CONTACT_SESSION 0
+/**
+ * @brief	Number of neighbours remembered to tell if a contact is new.
+ */
+#define DTN_CONTACTS 4
+/**
+ * @brief	A neighbour not heard for this long is a new contact when heard again.
+ */
+#define DTN_CONTACT_TIMEOUT 10*CLOCK_SECOND
+/**
+ * @brief	Beacons. If 1 every node broadcasts a beacon on DTN_BEACON_CHANNEL to tell its neighbours it is around.
+ *       	Sprays are then only sent while a neighbour was heard within DTN_CONTACT_TIMEOUT, and a packet 
+ *       	waiting for its End Receiver (1 copy) only while the End Receiver is around. 
+ *       	If 0 the sprays themselves are used to find neighbours.
+ */
+#define DTN_BEACONS 0
+/**
+ * @brief	Mean time between two beacons. Shorter than DTN_CONTACT_TIMEOUT so a neighbour is not lost between beacons.
+ */
+#define DTN_BEACON_INTERVAL 4*CLOCK_SECOND
+/**
+ * @brief	Role of the node. Advertised in the beacons with the spare room of the queue, so DTN_BEACONS must be 1 
+ *       	on every node for ferries to be known.
+ *       	- DTN_ROLE_STATIC: A sensor. It hands its copies to a ferry rather than splitting them with peers.
+ *       	- DTN_ROLE_FERRY: A data mule, e.g. a bus, with a bigger queue that meets many nodes.
+ */
+#define DTN_ROLE_STATIC 0
+#define DTN_ROLE_FERRY 1
+#define DTN_ROLE DTN_ROLE_STATIC
+/**
+ * @brief	Custody transfer to ferries. If 1 a static node hands all the copies of a packet to a ferry with room and drops 
+ *       	its own once ACKed, and a ferry requests every packet sprayed. If 0 all copies but one are handed, the last
+ *       	one is kept for a direct delivery.
+ */
+#define DTN_FERRY_CUSTODY 0
+/**
+ * @brief	Link Aware Handoff. If 1 copies are not handed off to a neighbour whose average link quality is 
+ *       	below DTN_LINK_MIN_LQI, so no runicast is spent retrying over a marginal link. 
+ *       	The End Receiver is always served.
+ */
+#define DTN_LINK_AWARE 0
+/**
+ * @brief	Lowest average link quality (PACKETBUF_ATTR_LINK_QUALITY) a handoff is sent over. 
+ *       	The scale depends on the radio, for the CC2420 LQI goes from about 50 (worst) to 110 (best).
+ */
+#define DTN_LINK_MIN_LQI 80
+/**
+ * @brief	Number of End Senders whose delivered packets are remembered. Gossiped with every spray so relays 
+ *       	drop their copies and the End Sender learns what arrived.
+ */
+#define DTN_TOMBSTONES 8
+/**
+ * @brief	Number of packets before the highest delivered one a tombstone covers. The bits of its bitmap.
+ */
+#define DTN_TOMB_SPAN 16
 /**
  * @brief	Packet that has not been given any Copies to propogate is dropped after this value
  */
 #define DTN_TIMEOUT_UNCONFIRMED 1*CLOCK_SECOND
+/**
+ * @brief	Time a requested packet waits for its handoff. With a Duty Cycled MAC the request, the handoff 
+ *       	and its ACK each wait up to a wake interval, one more is left for a collision.
+ */
+#define DTN_HANDOFF_WAIT ((DTN_DUTY_CYCLE == 1) ? DTN_TIMEOUT_UNCONFIRMED + 4 * DTN_WAKE_INTERVAL : DTN_TIMEOUT_UNCONFIRMED)
+/**
+ * @brief	Number of staging slots. A requested packet waits in a slot for its handoff, 
+ *       	so no queue buffer is used until copies are confirmed.
+ */
+#define DTN_STAGE_SLOTS 3
 /**
  * @brief	The FIXED Lifetime a packet has in a queue. Used when log equation is not used.
  */
 #define DTN_MAX_LIFETIME 60*CLOCK_SECOND
+/**
+ * @brief	Lifetime Models. Give the lifetime of a packet in a queue from its number of copies L.
+ *       	- DTN_LIFETIME_FIXED: Every packet lives DTN_MAX_LIFETIME.
+ *       	- DTN_LIFETIME_LOG: 2*LOG2(L)*(time of a round of the queue). A packet with more copies to give lives longer.
+ *       		LOG2 is computed with integers, no math library is linked.
+ */
+#define DTN_LIFETIME_FIXED 0
+#define DTN_LIFETIME_LOG 1
+/**
+ * @brief	The Lifetime Model used. NB: DTN_LIFETIME_FIXED was used so far.
+ */
+#define DTN_LIFETIME_MODEL DTN_LIFETIME_FIXED
+/**
+ * @brief	Longest lifetime given by DTN_LIFETIME_LOG or taken by dtn_set_config(). Keeps deadlines within half 
+ *       	the range of a 16 bit clock.
+ */
+#define DTN_LIFETIME_CAP 120*CLOCK_SECOND
+/**
+ * @brief	End to end lifetime of a packet in seconds. Set by the End Sender and carried in the header. 
+ *       	The lifetime in a queue never goes past it, so a packet relayed many times does not live forever.
+ */
+#define DTN_BUNDLE_TTL 300
+/**
+ * @brief 	A handoff waiting for an ACK.
+ * @details 	A handoff waiting for an ACK. Every slot has its own Reliable Unicast channel so 
+ *           	handoffs to different neighbours can be in flight at once.
+ *           	- rc: The Reliable Unicast connection. Must be first so the slot is found from the callbacks.
+ *           	- to: The neighbour the handoff was sent to.
+ *           	- esender: The End Sender of the packet handed off.
+ *           	- epacketid: The ID of the packet handed off. The packet is looked up again when the ACK
+ *          		arrives since it might have expired.
+ *           	- num_copies: The number of copies given to the neighbour.
+ *           	- in_use: 1 (True) while waiting for ACK.
+ *           	- session: 1 (True) if the slot runs a contact session. On ACK the next packet is handed off.
+ *           	- next_pos: Position in the queue of the next packet the session looks at. Moved when a packet 
+ *          		before it is added or removed.
+ *           	- room: Packets of each class the neighbour said it can still take. The session only pushes into this room.
+ */
+struct dtn_handoff{
+	struct runicast_conn rc;
+	rimeaddr_t to;
+	rimeaddr_t esender;
+	uint16_t epacketid;
+	uint16_t num_copies;
+	uint8_t in_use;
+	uint8_t session;
+	uint16_t next_pos;
+	uint8_t room[DTN_CLASSES];
+};
+
+/**
+ * @brief 	A neighbour recently heard.
+ * @details 	A neighbour recently heard. Used to tell if a request comes from a new contact and, with 
+ *           	DTN_BEACONS, which neighbours are around.
+ *           	- addr: The neighbour address.
+ *           	- last_seen: Clock time of the last request from the neighbour.
+ *           	- last_heard: Clock time of the last broadcast or beacon from the neighbour.
+ *           	- rssi: Average RSSI of the frames received from the neighbour.
+ *           	- lqi: Average link quality of the frames received from the neighbour.
+ *           	- role: The role advertised in the beacons. One of DTN_ROLE_*.
+ *           	- capacity: The spare room advertised in the beacons.
+ */
+struct dtn_contact{
+	rimeaddr_t addr;
+	clock_time_t last_seen;
+	clock_time_t last_heard;
+	int16_t rssi;
+	uint16_t lqi;
+	uint8_t role;
+	uint8_t capacity;
+};
+
+
 /**
  * @brief 	Holds the Rime channels
  */
 struct dtn_channels{
 	struct broadcast_conn bc;
+	struct broadcast_conn beacon;
 	struct unicast_conn uc;
-	struct runicast_conn rc;
+	struct dtn_handoff rc[DTN_HANDOFF_SLOTS];
 };
 
 /**
  * @brief 	Structure used to hold general variables
  * @details 	Holds variables that are required throughout the execution of the protocol
- *           	- *pkt_last_sent: Points to the last pkt sent. Used by the method that handles
+ *           	- *pkt_last_sent: Points to the last pkt sent of every class. Used by the method that handles
  *          			 the next packet to be broadcasted.
- *              - pkt_seq_no: Holds an integer which will be used as an id when generating an new message
- *              - *pkt_q: Holds the packet queue. Which is initialised in the beginning.
+ *              - pkt_seq_no: Holds an integer which will be used as an id when generating an new message. 
+ *          		DTN_ID_SEQ_BITS wide.
+ *              - epoch: The boot epoch. Put in the upper bits of the id of every new message. Moves on at every 
+ *          		restart and wrap of pkt_seq_no, so it wraps after 256 of them. See DTN_ID_SEQ_BITS.
+ *              - *pkt_q: Holds the packet queue of every class. Which is initialised in the beginning.
  *              - local_ctimer: Used to initialise packet queue timer.
- *              - *sent_runicast: Holds the packet item that a runicast has been sent for. Important 
- *          		because when success is received, there isn't a way how to know which packet
- *          		has been ACKed. 
+ *              - expiry_ctimer: The only timer used to expire packets. Set to the earliest lifetime.
+ *              - *expiry_list: The index entries of the queued packets sorted by the end of their lifetime.
+ *          		A singly linked list, inserting and removing walk it.
+ *              - tomb_next: Position in the tombstone ring where the next End Sender is saved.
+ *              - tomb_count: Number of End Senders in the tombstone ring.
+ *              - tomb_pending: Set when a neighbour sprayed a delivered packet or a delivery was learnt. 
+ *          		The tombstones are then broadcasted even if the queue is empty.
+ *              - *callbacks: Callbacks of the application.
+ *              - flash_next: Record of the flash log where the next packet is written. Records are used in turn.
+ *              - flash_read: Record of the flash log where the next packet to page in is looked for.
+ *              - cadence: Delay after the next round of the queue. Used by the Adaptive Cadence.
+ *              - responded: Set when a request is received. The cadence is not doubled after the round.
+ *              - beacon_ctimer: Timer of the next beacon. Used by DTN_BEACONS.
+ *              - sched_class: The class the spray scheduler is serving.
+ *              - sched_credit: Packets the class served can still spray in its turn.
+ *              - sched_sent: Packets looked at in this round. The round ends once all queued packets were.
+ *              - config_pending: Set when the configuration is to be broadcasted. It changed or a neighbour has an older one.
  */
 struct dtn_vars{
-	struct packetqueue_item *pkt_last_sent;
-	uint8_t pkt_seq_no;
-	struct packetqueue *pkt_q;
+	struct packetqueue_item *pkt_last_sent[DTN_CLASSES];
+	uint16_t pkt_seq_no;
+	uint8_t epoch;
+	struct packetqueue *pkt_q[DTN_CLASSES];
 	struct ctimer local_ctimer;
-	struct packetqueue_item *sent_runicast;
+	struct ctimer expiry_ctimer;
+	struct dtn_index_item *expiry_list;
+	uint8_t tomb_next;
+	uint8_t tomb_count;
+	uint8_t tomb_pending;
+	const struct dtn_callbacks *callbacks;
+	uint8_t flash_next;
+	uint8_t flash_read;
+	clock_time_t cadence;
+	uint8_t responded;
+	struct ctimer beacon_ctimer;
+	uint8_t sched_class;
+	uint8_t sched_credit;
+	uint16_t sched_sent;
+	uint8_t config_pending;
+};
+
+/**
+ * @brief	The packets of an End Sender known to be delivered to their End Receiver.
+ * @details	The packets of an End Sender known to be delivered to their End Receiver. A cumulative acknowledgement:
+ *          - esender: The End Sender of the packets.
+ *          - epacketid: The highest ID delivered.
+ *          - bitmap: Bit i is set if the packet with ID epacketid - 1 - i is delivered.
+ */
+struct dtn_tombstone {
+	rimeaddr_t esender;
+	uint16_t epacketid;
+	uint16_t bitmap;
+} DTN_PACKED;
+
+/**
+ * @brief	Room added at the end of a request.
+ * @details	Room added at the end of a request. Tells a Contact Session how much it can push unrequested.
+ *          - room: Packets the queue of each class of the requester can still take.
+ */
+struct dtn_request_room {
+	uint8_t room[DTN_CLASSES];
+} DTN_PACKED;
+
+/**
+ * @brief	Header of the tombstones added at the end of a spray.
+ * @details	Header of the tombstones added at the end of a spray, batch spray or offer:
+ *          - magic: Set to 'T'
+ *          - num_tombstones: The number of struct dtn_tombstone that follow.
+ */
+struct dtn_tombstone_header {
+	uint8_t magic;
+	uint8_t num_tombstones;
+} DTN_PACKED;
+
+/**
+ * @brief 	Entry of the bundle index. One is kept for every packet in the queue.
+ * @details 	Holds a copy of the fields that identify a queued packet so that it can be found
+ *           	without reading the queue buffer.
+ *           	- *next: Next entry in the same bucket. Used by the list library.
+ *           	- *item: The packet queue item the entry refers to.
+ *           	- esender: The End Sender of the packet.
+ *           	- ereceiver: The End Receiver of the packet.
+ *           	- epacketid: The ID given to the packet by the End Sender.
+ *           	- *next_expiry: Next entry in the expiry list.
+ *           	- deadline: Clock time when the lifetime of the packet ends.
+ *           	- queued: Clock time when the packet was queued. Used by the Eviction Policy.
+ */
+struct dtn_index_item{
+	struct dtn_index_item *next;
+	struct packetqueue_item *item;
+	rimeaddr_t esender;
+	rimeaddr_t ereceiver;
+	uint16_t epacketid;
+	struct dtn_index_item *next_expiry;
+	clock_time_t deadline;
+	clock_time_t queued;
 };
 
 /**
  * @brief	Sub Struct of the MSG header. 
  * @details	Holds Protocol General Information:
  *          - version: The Version of the protocol
- *          - magic: is a 2 byte array used to state the name of the protocol
+ *          - type: The frame. 'W' for a packet, 'B' for a batch, 'O' for an offer, 'H' for a beacon
+ *          	and 'C' for a configuration.
  */
 struct dtn_proto_header {
 	uint8_t version;
-	uint8_t magic[2];
+	uint8_t type;
+} DTN_PACKED;
+
+
+/**
+ * @brief	Beacon sent on DTN_BEACON_CHANNEL.
+ * @details	Beacon sent on DTN_BEACON_CHANNEL. The sender is known from the Rime header so it is made of:
+ *          - protocol: Holds protocol related information. The type is set to 'H'.
+ *          - role: The role of the sender. One of DTN_ROLE_*.
+ *          - capacity: Packets the queue of the sender can still take.
+ */
+struct dtn_beacon {
+	struct dtn_proto_header protocol;
+	uint8_t role;
+	uint8_t capacity;
+} DTN_PACKED;
+
+/**
+ * @brief	The parameters that can be changed at run time.
+ * @details	The parameters that can be changed at run time. Set by dtn_set_config() or by a configuration
+ *          pushed through the network. Start from the defines of the same name.
+ *          - seq: The version of the configuration. 0 until it is changed, then the newest one is kept by every node.
+ *          - copies: Copies given to a new packet, per class. DTN_L_COPIES for DTN_CLASS_TELEMETRY.
+ *          - packet_delay: Delay between the packets of a round. DTN_SPRAY_GAP.
+ *          - queue_delay: Delay after a round of the queue. DTN_QUEUE_DELAY.
+ *          - handoff_wait: Time a requested packet waits for its handoff. DTN_HANDOFF_WAIT.
+ *          - max_lifetime: Lifetime of a packet with the fixed lifetime model. DTN_MAX_LIFETIME.
+ *          - max_transmissions: Transmissions of a handoff. DTN_MAX_TRANSMISSIONs.
+ */
+struct dtn_config {
+	uint8_t seq;
+	uint8_t copies[DTN_CLASSES];
+	clock_time_t packet_delay;
+	clock_time_t queue_delay;
+	clock_time_t handoff_wait;
+	clock_time_t max_lifetime;
+	uint8_t max_transmissions;
 };
 
+/**
+ * @brief	A configuration pushed through the network.
+ * @details	A configuration pushed through the network. Broadcasted to every new neighbour once it changed. 
+ *          The fields are the ones of struct dtn_config. Delays in ms and the lifetime in seconds,
+ *          so nodes with a different CLOCK_SECOND agree.
+ *          - protocol: Holds protocol related information. The type is set to 'C'.
+ */
+struct dtn_config_msg {
+	struct dtn_proto_header protocol;
+	uint8_t seq;
+	uint8_t copies[DTN_CLASSES];
+	uint16_t packet_delay;
+	uint16_t queue_delay;
+	uint16_t handoff_wait;
+	uint16_t max_lifetime;
+	uint8_t max_transmissions;
+} DTN_PACKED;
+
+/**
+ * @brief	Header of a Batch Spray or Offer.
+ * @details	Holds Batch Spray Information:
+ *          - protocol: Holds protocol related information. The type is set to 'B' for a batch
+ *          	and to 'O' for an offer.
+ *          - num_packets: The number of packets in the batch. Every packet is preceded by a byte 
+ *          	holding its length. In a batch it is made of the header and data as they are saved in the queue,
+ *          	in an offer of the header only.
+ */
+struct dtn_batch_header {
+	struct dtn_proto_header protocol;
+	uint8_t num_packets;
+} DTN_PACKED;
 
 /**
  * @brief The Protocol Header that is used for every package sent from DTN
  * @details The Protocol Header that is used for every package sent from DTN.
  *          This is vital because it contains all the information needed so the protocol works.
- *          	- protocol: Holds protocol related information. Such as version
+ *          	- protocol: Holds protocol related information. Such as version. The type is set to 'W'.
  *          	- num_copies: The number of copies that a receiving node can distribute. Used in two important ways:
  *          		-# If the value is 1 on broadcast this means that this is not an actual spray.
  *          			But searching for destination. Used so we do not implemment another channel for neighbour discovery
  *          		-# During runicast (HandOff) the actual L value that should be saved is sent.
+ *          		-# In a request (Unicast) the metric of the forwarding strategy is sent. 
+ *          			The delivery predictability for the End Receiver with DTN_STRATEGY_PROPHET, 0 otherwise.
  *          	- esender: Show the origin Sender
  *          	- ereceiver: Shows the intended message to.
  *          	- epacketid: The ID given to the message. Should be kept through out the packet life.
+ *          		The boot epoch of the End Sender followed by DTN_ID_SEQ_BITS of sequence number.
+ *          		Unique until the epoch wraps, see DTN_ID_SEQ_BITS.
+ *          		Every fragment has its own ID. The first fragment has ID epacketid - frag_index.
+ *          	- data_len: Length of the data following the header. Max DTN_FRAG_SIZE.
+ *          	- frag_index: Position of the fragment in the payload. 0 if not fragmented.
+ *          	- frag_total: Number of fragments of the payload. 1 if not fragmented.
+ *          	- tclass: The traffic class. One of DTN_CLASS_*. Every node queues the packet in the queue of its class.
+ *          	- age: Seconds since the End Sender created the packet. Every node adds the time the packet 
+ *          		was queued before sending it on. Time spent in the Flash Store is not counted.
+ *          	- ttl: End to end lifetime in seconds. The packet is dropped once age reaches it.
  */
 struct dtn_msg_header {
 	struct dtn_proto_header protocol;
-	uint16_t num_copies;
+	uint8_t num_copies;
 	rimeaddr_t esender;
 	rimeaddr_t ereceiver;
 	uint16_t epacketid;
+	uint8_t data_len;
+	uint8_t frag_index;
+	uint8_t frag_total;
+	uint8_t tclass;
+	uint16_t age;
+	uint16_t ttl;
+} DTN_PACKED;
+
+/**
+ * @brief 	A fragmented payload being reassembled at its End Receiver.
+ * @details 	A fragmented payload being reassembled at its End Receiver. Fragments are stored and forwarded 
+ *           	as independent packets and put together only at the destination.
+ *           	- in_use: 1 (True) while fragments are missing.
+ *           	- esender: The End Sender of the payload.
+ *           	- base_id: The ID of the first fragment.
+ *           	- frag_total: Number of fragments of the payload.
+ *           	- received: Bit mask of the fragments received.
+ *           	- len: Length of the payload received so far.
+ *           	- deadline: Clock time after which the missing fragments are not waited for. Checked when a fragment arrives.
+ *           	- data: The payload. Fragment i is at i*DTN_FRAG_SIZE.
+ */
+struct dtn_reassembly{
+	uint8_t in_use;
+	rimeaddr_t esender;
+	uint16_t base_id;
+	uint8_t frag_total;
+	uint16_t received;
+	uint16_t len;
+	clock_time_t deadline;
+	uint8_t data[DTN_MAX_FRAGS * DTN_FRAG_SIZE];
 };
 
 /**
- * @brief Holds the data message. For now holds a char array.
- * 
+ * @brief 	The open bundle of dtn_append().
+ * @details 	The open bundle of dtn_append(). Readings for the same End Receiver and class are put one after
+ *           	the other until the bundle is full or DTN_AGGREGATE_DELAY passed.
+ *           	- len: Length of the readings held. 0 if no bundle is open.
+ *           	- ereceiver: The End Receiver of the bundle.
+ *           	- tclass: The traffic class of the bundle.
+ *           	- ctimer: Seals the bundle after DTN_AGGREGATE_DELAY.
+ *           	- data: The readings.
+ */
+struct dtn_aggregate{
+	uint8_t len;
+	rimeaddr_t ereceiver;
+	uint8_t tclass;
+	struct ctimer ctimer;
+	uint8_t data[DTN_AGGREGATE_SIZE];
+};
+
+/**
+ * @brief 	A record of the Flash Store index.
+ * @details 	A record of the Flash Store index. Record i of the index tells what record i of the log holds.
+ *           	Kept in RAM and written through to flash.
+ *           	- in_use: 1 (True) if the log record holds a packet.
+ *           	- len: Length of the packet. Header followed by the data.
+ *           	- esender: The End Sender of the packet.
+ *           	- epacketid: The ID of the packet.
+ *           	- tclass: The traffic class of the packet.
  */
-struct dtn_msg_data {
-	char data[10];
+struct dtn_flash_entry{
+	uint8_t in_use;
+	uint8_t len;
+	rimeaddr_t esender;
+	uint16_t epacketid;
+	uint8_t tclass;
+};
+
+/**
+ * @brief 	Callbacks of the application using the protocol.
+ * @details 	Callbacks of the application using the protocol.
+ *           	- recv: Called when a payload is delivered to this node. Fragmented payloads once all fragments arrived.
+ *           	- delivered: Called when a packet sent by this node is known to be delivered. With the ID returned by 
+ *           		dtn_new_buff(). Called for every fragment, fragment i has ID + i. Can be NULL (0).
+ */
+struct dtn_callbacks{
+	void (*recv)(const rimeaddr_t *esender, const uint8_t *data, uint16_t len);
+	void (*delivered)(uint16_t epacketid);
+};
+
+/**
+ * @brief 	A Forwarding Strategy. Selected with DTN_STRATEGY.
+ * @details 	A Forwarding Strategy. Holds the forwarding decisions, every strategy keeps its own state. 
+ *           	The End Receiver is always given all copies and is not asked.
+ *           	- init: Called by dtn_init(). Can be NULL (0).
+ *           	- encounter: Called when a neighbour is heard that was not heard within DTN_CONTACT_TIMEOUT. Can be NULL (0).
+ *           	- wants: Returns 1 (True) if a relay should ask for the sprayed packet and 0 (False) if not.
+ *           	- metric: Returns the metric sent with a request for a packet to the End Receiver. Can be NULL (0).
+ *           	- copies: Returns the copies to give to the neighbour from the copies available and the metric 
+ *           		of its request. 0 if the packet is not handed off.
+ *           	- kept: Returns the copies kept once the neighbour ACKed the copies given.
+ */
+struct dtn_strategy{
+	void (*init)();
+	void (*encounter)(const rimeaddr_t *neighbour);
+	uint8_t (*wants)(const struct dtn_msg_header *hdr);
+	uint16_t (*metric)(const rimeaddr_t *ereceiver);
+	uint16_t (*copies)(const struct dtn_msg_header *hdr, uint16_t available, const rimeaddr_t *to, uint16_t metric);
+	uint16_t (*kept)(uint16_t num_copies, uint16_t given);
+};
+
+/**
+ * @brief 	Delivery predictability of DTN_STRATEGY_PROPHET.
+ * @details 	Delivery predictability of DTN_STRATEGY_PROPHET for an End Receiver.
+ *           	- addr: The End Receiver.
+ *           	- p: The predictability, 0 to 255.
+ *           	- aged: Clock time up to which the predictability was aged.
+ */
+struct dtn_prophet{
+	rimeaddr_t addr;
+	uint8_t p;
+	clock_time_t aged;
+};
+
+/**
+ * @brief 	A requested packet waiting for its handoff.
+ * @details 	A requested packet waiting for its handoff. Replaces the placeholder with 0 copies in the queue.
+ *           	- next: Next slot in the staging list. Must be first to be used with the list library.
+ *           	- deadline: Clock time after which the slot is free again. Checked when the list is visited.
+ *           	- len: Length of the packet staged.
+ *           	- bundle: The packet. Header followed by the data.
+ */
+struct dtn_stage{
+	struct dtn_stage *next;
+	clock_time_t deadline;
+	uint8_t len;
+	uint8_t bundle[sizeof(struct dtn_msg_header) + DTN_FRAG_SIZE];
+};
+
+/**
+ * @brief 	Time spent by an operation.
+ * @details 	Time spent by an operation, in RTIMER_SECOND ticks as counted by Energest.
+ *           	- cpu: Time the CPU was active.
+ *           	- tx: Time the radio was transmitting.
+ *           	- rx: Time the radio was listening.
+ *           	- calls: Times the operation was run.
+ */
+struct dtn_energy{
+	uint32_t cpu;
+	uint32_t tx;
+	uint32_t rx;
+	uint16_t calls;
+};
+
+/**
+ * @brief 	The statistics counters.
+ * @details 	The statistics counters. Kept when DTN_STATS is 1. Counters wrap around.
+ *           	- sprays_sent: Broadcasts sent. A Batch Spray counts once.
+ *           	- requests_sent: Requests (Unicast) sent.
+ *           	- requests_recv: Requests (Unicast) received.
+ *           	- handoffs_sent: Handoffs (Reliable Unicast) sent. One refused by runicast_send() is not counted.
+ *           	- handoffs_recv: Handoffs (Reliable Unicast) received.
+ *           	- runic_acked: Handoffs ACKed.
+ *           	- runic_timedout: Handoffs timed out.
+ *           	- runic_retransmissions: Retransmissions of ACKed and timed out handoffs.
+ *           	- handoffs_skipped: Requests not served since the link to the neighbour is too weak.
+ *           	- drop_queue_full: Packets dropped since the queue is full.
+ *           	- drop_no_buffer: Packets dropped since no queue buffer or index entry was free.
+ *           	- drop_held: Sprays dropped since the packet is already held with copies.
+ *           	- drop_not_dtn: Frames dropped since they are not from a Spray and Wait protocol, or malformed batches.
+ *           	- evicted: Packets evicted to make room.
+ *           	- expired: Packets whose lifetime ended in the queue.
+ *           	- delivered: Packets delivered to this node.
+ *           	- queue_high: Most packets the queue held at once.
+ *           	- delivered_own: Packets sent by this node known to be delivered.
+ *           	- energy: Time spent per operation. One of DTN_OP_*. Kept when DTN_ENERGEST is 1.
+ *           	- energy_total: Time spent by the node since dtn_init(), in the protocol or not. Set by dtn_stats().
+ *           	- energy_per_delivered: Energy in uJ spent by the node per packet in delivered_own. Set by dtn_stats().
+ *           		The network figure is the sum over the nodes divided by the packets delivered.
+ */
+struct dtn_stats{
+	uint16_t sprays_sent;
+	uint16_t requests_sent;
+	uint16_t requests_recv;
+	uint16_t handoffs_sent;
+	uint16_t handoffs_recv;
+	uint16_t runic_acked;
+	uint16_t runic_timedout;
+	uint16_t runic_retransmissions;
+	uint16_t handoffs_skipped;
+	uint16_t drop_queue_full;
+	uint16_t drop_no_buffer;
+	uint16_t drop_held;
+	uint16_t drop_not_dtn;
+	uint16_t evicted;
+	uint16_t expired;
+	uint16_t delivered;
+	uint16_t queue_high;
+	uint16_t delivered_own;
+	struct dtn_energy energy[DTN_OPS];
+	struct dtn_energy energy_total;
+	uint64_t energy_per_delivered;
+};
+
+/**
+ * @brief 	A traced frame.
+ * @details 	A traced frame. Written in the trace ring when DTN_TRACE is DTN_TRACE_RING.
+ *           	- event: The frame sent. One of DTN_EV_*.
+ *           	- is_dtn: 1 (True) if the frame has a Spray and Wait header. If 0 the fields after receiver are not set.
+ *           	- time: Clock time when the frame was sent.
+ *           	- sender: The packet buffer sender address.
+ *           	- receiver: The packet buffer receiver address.
+ *           	- esender: The End Sender of the packet.
+ *           	- ereceiver: The End Receiver of the packet.
+ *           	- epacketid: The ID of the packet.
+ *           	- num_copies: The number of copies in the frame.
+ */
+struct dtn_trace_record{
+	uint8_t event;
+	uint8_t is_dtn;
+	clock_time_t time;
+	rimeaddr_t sender;
+	rimeaddr_t receiver;
+	rimeaddr_t esender;
+	rimeaddr_t ereceiver;
+	uint16_t epacketid;
+	uint16_t num_copies;
 };
 
 /**
  * @brief Initialises all the variables and rime channels.
  * @details Initialises all the variables and rime channels. 
  *          This includes the struct dtn_vars and channels for broadcast, unicast and runicast 
+ * 
+ * @param callbacks Callbacks of the application. Can be NULL (0).
  */
-void dtn_init();
+void dtn_init(const struct dtn_callbacks *callbacks);
 
 /**
  * @brief Close channels
@@ -145,12 +965,84 @@ void dtn_close();
  */
 int dtn_q_size();
 
+/**
+ * @brief Get the statistics counters.
+ * @details Get the statistics counters. Counted since dtn_init().
+ * @return Pointer to the counters or NULL (0) if DTN_STATS is 0.
+ */
+const struct dtn_stats *dtn_stats();
+
+/**
+ * @brief Get the current configuration.
+ * @details Get the current configuration.
+ * 
+ * @param dtn_config Where the configuration is copied.
+ */
+void dtn_get_config(struct dtn_config *conf);
+
+/**
+ * @brief Change the configuration.
+ * @details Change the configuration and push it through the network. Every node met takes it and passes it on,
+ *          so the whole network is tuned without reflashing. The seq passed is not used, a newer one is given.
+ *          There is no authentication: any node can push a configuration.
+ * 
+ * @param dtn_config The new configuration.
+ * @return 1 (True) if it was taken, 0 (False) if a parameter is 0 or out of range: a delay past half 
+ *         the clock range or 65535 ms, a lifetime under 1 s or past DTN_LIFETIME_CAP.
+ */
+int dtn_set_config(const struct dtn_config *conf);
+
+/**
+ * @brief Read the oldest record of the trace ring.
+ * @details Read the oldest record of the trace ring. The record is removed from the ring.
+ * 
+ * @param dtn_trace_record Where the record is copied.
+ * @return 1 (True) if a record was read, 0 (False) if the ring is empty or DTN_TRACE is not DTN_TRACE_RING.
+ */
+int dtn_trace_read(struct dtn_trace_record *rec);
+
+/**
+ * @brief Print a trace record as text.
+ * @details Print a trace record as text. The format is the one printed by DTN_TRACE_TEXT.
+ * 
+ * @param dtn_trace_record The record to print.
+ */
+void dtn_trace_print(const struct dtn_trace_record *rec);
+
 /**
  * @brief Create a new message.
  * @details Creates a new message. When the message is created it is added to the packet queue.
  *          NB: If the queue is full the message is dropped. This is part of the protocol specification.
+ *          Unless DTN_EVICT_POLICY makes room for it.
+ *          A payload bigger than DTN_FRAG_SIZE is split in fragments. Either all fragments are queued or none.
  * 
- * @param dtn_msg_data Data that will populate the message
+ * @param data Data that will populate the message
+ * @param len Length of the data. At most DTN_MAX_FRAGS*DTN_FRAG_SIZE.
  * @param destination Destination to whom the packete should be sent.
+ * @param tclass The traffic class. One of DTN_CLASS_*.
+ * @return The ID of the message, passed to the delivered callback. DTN_NO_ID if it was not queued.
+ */
+uint16_t dtn_new_buff(const void *data, uint16_t len, const rimeaddr_t *destination, uint8_t tclass);
+
+/**
+ * @brief Add a reading to the open bundle.
+ * @details Add a reading to the open bundle. Readings for the same destination and class share one bundle,
+ *          so one header and one set of copies carry many readings. The bundle is sealed and queued as 
+ *          dtn_new_buff() does when the next reading does not fit, when a reading for an other destination
+ *          or class comes or DTN_AGGREGATE_DELAY after the first reading.
+ *          The readings are delivered one after the other with no separator. They should have a fixed size
+ *          or carry their own length.
+ * 
+ * @param data The reading.
+ * @param len Length of the reading. At most DTN_AGGREGATE_SIZE.
+ * @param destination Destination to whom the reading should be sent.
+ * @param tclass The traffic class. One of DTN_CLASS_*.
+ * @return 1 (True) if the reading was added, 0 (False) if it is too long or the class is not known.
+ */
+int dtn_append(const void *data, uint8_t len, const rimeaddr_t *destination, uint8_t tclass);
+
+/**
+ * @brief Seal the open bundle.
+ * @details Seal the open bundle now and queue it. Nothing is done if no bundle is open.
  */
-void dtn_new_buff(struct dtn_msg_data *data, const rimeaddr_t *destination);
\ No newline at end of file
+void dtn_flush();
\ No newline at end of file
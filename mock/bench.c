@@ -0,0 +1,147 @@
+/**
+ * @file
+ *        Microbenchmarks of the queue engine of dtn.c, built on the build host against the mock of
+ *        this directory. dtn.c is included so its static functions can be timed directly.
+ *        The queue size is set at build time with DTN_CONF_QUEUE_PACKETS, see the Makefile.
+ *        Prints one line per operation: the queue size, the operation, the nanoseconds per call
+ *        (best of BENCH_ROUNDS) and, for broadcast_next, the frames sent in one round of the queue.
+ */
+
+#include "../dtn.c"
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 20
+#define BENCH_LOOKUPS 10
+#define BENCH_PAYLOAD 10
+
+static struct packetqueue_item *bench_items[MAX_QUEUE_PACKETS];
+static uint16_t bench_ids[MAX_QUEUE_PACKETS];
+static const rimeaddr_t bench_dest = {{2, 0}};
+
+/**
+ * @brief Monotonic time in nanoseconds.
+ */
+static uint64_t
+bench_ns(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Keep the best time of an operation.
+ *
+ * @param best The best time so far.
+ * @param start Time the rounds started.
+ * @param calls Calls in the round.
+ */
+static void
+bench_keep(uint64_t *best, uint64_t start, unsigned long calls){
+	uint64_t per_call = (bench_ns() - start) / calls;
+
+	if(*best == 0 || per_call < *best){
+		*best = per_call;
+	}
+}
+
+/**
+ * @brief Fill the telemetry queue with new packets of this node.
+ */
+static void
+bench_fill(){
+	uint8_t payload[BENCH_PAYLOAD];
+	int i;
+
+	memset(payload, 0x5A, sizeof(payload));
+	for(i = 0; i < MAX_QUEUE_PACKETS; i++){
+		bench_ids[i] = dtn_new_buff(payload, sizeof(payload), &bench_dest, DTN_CLASS_TELEMETRY);
+		if(bench_ids[i] == DTN_NO_ID){
+			fprintf(stderr, "bench: queue full after %d packets\n", i);
+			exit(1);
+		}
+	}
+}
+
+/**
+ * @brief Remember the items of the queue, so they can be removed without walking it.
+ */
+static void
+bench_snapshot(){
+	struct packetqueue_item *item = packetqueue_first(dtn_global.pkt_q[DTN_CLASS_TELEMETRY]);
+	int i;
+
+	for(i = 0; item != NULL; item = item->next, i++){
+		bench_items[i] = item;
+	}
+}
+
+int
+main(){
+	uint64_t best_enqueue = 0;
+	uint64_t best_find = 0;
+	uint64_t best_bcast = 0;
+	uint64_t best_dequeue = 0;
+	uint64_t best_expiry = 0;
+	unsigned long frames = 0;
+	uint64_t start;
+	int round;
+	int i;
+	int j;
+
+	rimeaddr_node_addr.u8[0] = 1;
+	dtn_init(NULL);
+
+	for(round = 0; round < BENCH_ROUNDS; round++){
+		start = bench_ns();
+		bench_fill();
+		bench_keep(&best_enqueue, start, MAX_QUEUE_PACKETS);
+
+		start = bench_ns();
+		for(j = 0; j < BENCH_LOOKUPS; j++){
+			for(i = 0; i < MAX_QUEUE_PACKETS; i++){
+				if(find_packet(bench_ids[i], &rimeaddr_node_addr, &bench_dest) == NULL){
+					fprintf(stderr, "bench: packet %04x not found\n", bench_ids[i]);
+					return 1;
+				}
+			}
+		}
+		bench_keep(&best_find, start, (unsigned long) BENCH_LOOKUPS * MAX_QUEUE_PACKETS);
+
+		//One round of the spray schedule
+		mock_radio.broadcasts = 0;
+		start = bench_ns();
+		for(i = 0; i < MAX_QUEUE_PACKETS; i++){
+			broadcast_next(NULL);
+		}
+		bench_keep(&best_bcast, start, MAX_QUEUE_PACKETS);
+		frames = mock_radio.broadcasts;
+
+		bench_snapshot();
+		start = bench_ns();
+		for(i = 0; i < MAX_QUEUE_PACKETS; i++){
+			dtn_remove_queued_packet(bench_items[i]);
+		}
+		bench_keep(&best_dequeue, start, MAX_QUEUE_PACKETS);
+
+		//All the lifetimes end at once
+		bench_fill();
+		mock_jump(dtn_conf.max_lifetime + 1);
+		start = bench_ns();
+		expire_packets(NULL);
+		bench_keep(&best_expiry, start, MAX_QUEUE_PACKETS);
+		if(dtn_q_size() != 0){
+			fprintf(stderr, "bench: %d packets left after expiry\n", dtn_q_size());
+			return 1;
+		}
+	}
+
+	printf("%d enqueue %llu\n", MAX_QUEUE_PACKETS, (unsigned long long) best_enqueue);
+	printf("%d find_packet %llu\n", MAX_QUEUE_PACKETS, (unsigned long long) best_find);
+	printf("%d broadcast_next %llu %lu\n", MAX_QUEUE_PACKETS, (unsigned long long) best_bcast, frames);
+	printf("%d dequeue %llu\n", MAX_QUEUE_PACKETS, (unsigned long long) best_dequeue);
+	printf("%d expiry %llu\n", MAX_QUEUE_PACKETS, (unsigned long long) best_expiry);
+	dtn_close();
+	return 0;
+}
@@ -0,0 +1 @@
+#include "mock.h"
@@ -0,0 +1,275 @@
+/**
+ * @file
+ *        Mock of the parts of Contiki and Rime used by dtn.c. Lets dtn.c be built and driven
+ *        on the build host, without Contiki, by the benchmarks of this directory.
+ *        The types match the ones of a Tmote Sky: 16 bit clock, 2 byte Rime addresses.
+ */
+
+#ifndef MOCK_H
+#define MOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*------------------------------------- Clock ------------------------------------*/
+typedef unsigned short clock_time_t;
+#define CLOCK_SECOND 128
+#define CLOCK_LT(a, b) ((signed short)((a) - (b)) < 0)
+clock_time_t clock_time(void);
+unsigned long clock_seconds(void);
+
+/*------------------------------------- List -------------------------------------*/
+#define LIST_CONCAT2(s1, s2) s1##s2
+#define LIST_CONCAT(s1, s2) LIST_CONCAT2(s1, s2)
+#define LIST(name) static void *LIST_CONCAT(name, _list) = NULL; \
+	static list_t name = (list_t) &LIST_CONCAT(name, _list)
+typedef void ** list_t;
+void list_init(list_t list);
+void *list_head(list_t list);
+void *list_tail(list_t list);
+void list_add(list_t list, void *item);
+void list_push(list_t list, void *item);
+void list_remove(list_t list, void *item);
+int list_length(list_t list);
+void *list_item_next(void *item);
+
+/*------------------------------------- Memb -------------------------------------*/
+struct memb {
+	unsigned short size;
+	unsigned short num;
+	char *count;
+	void *mem;
+};
+#define MEMB(name, structure, num) \
+	static char LIST_CONCAT(name, _memb_count)[num]; \
+	static structure LIST_CONCAT(name, _memb_mem)[num]; \
+	static struct memb name = {sizeof(structure), num, LIST_CONCAT(name, _memb_count), (void *) LIST_CONCAT(name, _memb_mem)}
+void memb_init(struct memb *m);
+void *memb_alloc(struct memb *m);
+char memb_free(struct memb *m, void *ptr);
+int memb_numfree(struct memb *m);
+
+/*------------------------------------- Timers -----------------------------------*/
+struct ctimer {
+	struct ctimer *next;
+	clock_time_t start;
+	clock_time_t interval;
+	void (*f)(void *);
+	void *ptr;
+};
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr);
+void ctimer_stop(struct ctimer *c);
+int ctimer_expired(struct ctimer *c);
+
+/*------------------------------------- Processes --------------------------------*/
+typedef unsigned char process_event_t;
+typedef void * process_data_t;
+struct pt {
+	unsigned short lc;
+};
+struct process {
+	const char *name;
+	char (*thread)(struct pt *, process_event_t, process_data_t);
+	struct pt pt;
+};
+#define PT_YIELDED 1
+#define PT_ENDED 3
+#define PROCESS_EVENT_INIT 0x81
+#define PROCESS_EVENT_POLL 0x82
+#define PROCESS_EVENT_CONTINUE 0x85
+#define PROCESS_ERR_OK 0
+#define PROCESS_ERR_FULL 1
+#define PROCESS(name, strname) \
+	static char process_thread_##name(struct pt *process_pt, process_event_t ev, process_data_t data); \
+	struct process name = {strname, process_thread_##name}
+#define PROCESS_THREAD(name, ev, data) \
+	static char process_thread_##name(struct pt *process_pt, process_event_t ev, process_data_t data)
+#define PROCESS_BEGIN() { char PT_YIELD_FLAG = 1; (void) PT_YIELD_FLAG; (void) data; switch(process_pt->lc) { case 0:
+#define PROCESS_END() } process_pt->lc = 0; return PT_ENDED; }
+#define PROCESS_WAIT_EVENT_UNTIL(c) do { PT_YIELD_FLAG = 0; process_pt->lc = __LINE__; case __LINE__: \
+	if(PT_YIELD_FLAG == 0 || !(c)) { return PT_YIELDED; } } while(0)
+#define PROCESS_WAIT_EVENT() PROCESS_WAIT_EVENT_UNTIL(1)
+void process_start(struct process *p, process_data_t data);
+void process_poll(struct process *p);
+int process_post(struct process *p, process_event_t ev, process_data_t data);
+
+/*------------------------------------- Rime -------------------------------------*/
+#define RIMEADDR_SIZE 2
+typedef union {
+	unsigned char u8[RIMEADDR_SIZE];
+} rimeaddr_t;
+extern rimeaddr_t rimeaddr_node_addr;
+extern const rimeaddr_t rimeaddr_null;
+void rimeaddr_copy(rimeaddr_t *dest, const rimeaddr_t *from);
+unsigned char rimeaddr_cmp(const rimeaddr_t *addr1, const rimeaddr_t *addr2);
+
+#define PACKETBUF_SIZE 128
+#define PACKETBUF_HDR_SIZE 48
+typedef uint16_t packetbuf_attr_t;
+enum {
+	PACKETBUF_ATTR_NONE,
+	PACKETBUF_ATTR_RSSI,
+	PACKETBUF_ATTR_LINK_QUALITY,
+	PACKETBUF_ATTR_NUM,
+	PACKETBUF_ADDR_SENDER = 32,
+	PACKETBUF_ADDR_RECEIVER,
+	PACKETBUF_ADDR_LAST
+};
+void packetbuf_clear(void);
+void *packetbuf_dataptr(void);
+void *packetbuf_hdrptr(void);
+uint16_t packetbuf_datalen(void);
+uint16_t packetbuf_totlen(void);
+void packetbuf_set_datalen(uint16_t len);
+int packetbuf_copyfrom(const void *from, uint16_t len);
+int packetbuf_copyto(void *to);
+int packetbuf_hdralloc(int size);
+int packetbuf_set_attr(uint8_t type, const packetbuf_attr_t val);
+packetbuf_attr_t packetbuf_attr(uint8_t type);
+int packetbuf_set_addr(uint8_t type, const rimeaddr_t *addr);
+const rimeaddr_t *packetbuf_addr(uint8_t type);
+
+struct queuebuf;
+struct queuebuf *queuebuf_new_from_packetbuf(void);
+void queuebuf_to_packetbuf(struct queuebuf *b);
+void queuebuf_free(struct queuebuf *b);
+void *queuebuf_dataptr(struct queuebuf *b);
+int queuebuf_datalen(struct queuebuf *b);
+
+struct packetqueue {
+	list_t *list;
+	struct memb *memb;
+};
+struct packetqueue_item {
+	struct packetqueue_item *next;
+	struct queuebuf *buf;
+	struct packetqueue *queue;
+	struct ctimer lifetimer;
+	void *ptr;
+};
+#define PACKETQUEUE(name, size) LIST(name##_list); \
+	MEMB(name##_memb, struct packetqueue_item, size); \
+	static struct packetqueue name = {&name##_list, &name##_memb}
+void packetqueue_init(struct packetqueue *q);
+int packetqueue_enqueue_packetbuf(struct packetqueue *q, clock_time_t lifetime, void *ptr);
+struct packetqueue_item *packetqueue_first(struct packetqueue *q);
+void packetqueue_dequeue(struct packetqueue *q);
+int packetqueue_len(struct packetqueue *q);
+struct queuebuf *packetqueue_queuebuf(struct packetqueue_item *i);
+void *packetqueue_ptr(struct packetqueue_item *i);
+
+struct broadcast_conn;
+struct unicast_conn;
+struct runicast_conn;
+struct broadcast_callbacks {
+	void (*recv)(struct broadcast_conn *c, const rimeaddr_t *from);
+};
+struct broadcast_conn {
+	uint16_t channel;
+	const struct broadcast_callbacks *u;
+};
+struct unicast_callbacks {
+	void (*recv)(struct unicast_conn *c, const rimeaddr_t *from);
+};
+struct unicast_conn {
+	uint16_t channel;
+	const struct unicast_callbacks *u;
+};
+struct runicast_callbacks {
+	void (*recv)(struct runicast_conn *c, const rimeaddr_t *from, uint8_t seqno);
+	void (*sent)(struct runicast_conn *c, const rimeaddr_t *to, uint8_t retransmissions);
+	void (*timedout)(struct runicast_conn *c, const rimeaddr_t *to, uint8_t retransmissions);
+};
+struct runicast_conn {
+	struct runicast_conn *next;
+	uint16_t channel;
+	const struct runicast_callbacks *u;
+	uint8_t is_tx;
+	rimeaddr_t to;
+};
+void broadcast_open(struct broadcast_conn *c, uint16_t channel, const struct broadcast_callbacks *u);
+void broadcast_close(struct broadcast_conn *c);
+int broadcast_send(struct broadcast_conn *c);
+void unicast_open(struct unicast_conn *c, uint16_t channel, const struct unicast_callbacks *u);
+void unicast_close(struct unicast_conn *c);
+int unicast_send(struct unicast_conn *c, const rimeaddr_t *receiver);
+void runicast_open(struct runicast_conn *c, uint16_t channel, const struct runicast_callbacks *u);
+void runicast_close(struct runicast_conn *c);
+int runicast_send(struct runicast_conn *c, const rimeaddr_t *receiver, uint8_t max_retransmissions);
+uint8_t runicast_is_transmitting(struct runicast_conn *c);
+
+/*------------------------------------- Random -----------------------------------*/
+#define RANDOM_RAND_MAX 65535U
+unsigned short random_rand(void);
+void random_init(unsigned short seed);
+
+/*------------------------------------- Energest ---------------------------------*/
+#define ENERGEST_CONF_ON 1
+#define RTIMER_SECOND 32768
+enum {
+	ENERGEST_TYPE_CPU,
+	ENERGEST_TYPE_LPM,
+	ENERGEST_TYPE_TRANSMIT,
+	ENERGEST_TYPE_LISTEN,
+	ENERGEST_TYPE_MAX
+};
+unsigned long energest_type_time(int type);
+void energest_flush(void);
+
+/*------------------------------------- CFS --------------------------------------*/
+typedef long cfs_offset_t;
+#define CFS_READ 1
+#define CFS_WRITE 2
+#define CFS_APPEND 4
+#define CFS_SEEK_SET 0
+#define CFS_SEEK_CUR 1
+#define CFS_SEEK_END 2
+int cfs_open(const char *name, int flags);
+void cfs_close(int fd);
+int cfs_read(int fd, void *buf, unsigned int len);
+int cfs_write(int fd, const void *buf, unsigned int len);
+cfs_offset_t cfs_seek(int fd, cfs_offset_t offset, int whence);
+int cfs_remove(const char *name);
+int cfs_coffee_reserve(const char *name, cfs_offset_t size);
+
+/*------------------------------------- Mock control -----------------------------*/
+/**
+ * @brief 	Frames sent by the node.
+ * @details 	Frames sent by the node. Nothing is received, the frames are only counted.
+ *           	- broadcasts: Frames sent with broadcast_send().
+ *           	- unicasts: Frames sent with unicast_send().
+ *           	- runicasts: Frames sent with runicast_send(). ACKed on the next mock_advance().
+ *           	- bytes: Bytes of all the frames.
+ */
+struct mock_radio {
+	unsigned long broadcasts;
+	unsigned long unicasts;
+	unsigned long runicasts;
+	unsigned long bytes;
+};
+extern struct mock_radio mock_radio;
+
+/**
+ * @brief Move the clock forward.
+ * @details Move the clock forward one tick at a time. The ctimers due are fired, the runicasts
+ *          in flight are ACKed and the events posted are delivered.
+ *
+ * @param ticks Clock ticks to move.
+ */
+void mock_advance(clock_time_t ticks);
+
+/**
+ * @brief Move the clock forward without firing anything.
+ * @details Move the clock forward without firing anything. The code under test can then be called
+ *          directly with the work of that time due.
+ *
+ * @param ticks Clock ticks to move.
+ */
+void mock_jump(clock_time_t ticks);
+
+/**
+ * @brief Number of ctimers running.
+ */
+int mock_ctimers();
+
+#endif
@@ -0,0 +1,699 @@
+/**
+ * @file
+ *        Mock of the parts of Contiki and Rime used by dtn.c. One node, the clock only moves
+ *        with mock_advance() and the frames sent are counted, not received.
+ */
+
+#include "mock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef QUEUEBUF_CONF_NUM
+#define QUEUEBUF_CONF_NUM 8
+#endif
+#define MOCK_EVENTS 16
+#define MOCK_FILES 8
+#define MOCK_FILE_SIZE 16384
+#define MOCK_FDS 8
+
+struct mock_radio mock_radio;
+static clock_time_t mock_now;
+
+/*------------------------------------- Clock ------------------------------------*/
+clock_time_t
+clock_time(void){
+	return mock_now;
+}
+
+unsigned long
+clock_seconds(void){
+	return mock_now / CLOCK_SECOND;
+}
+
+/*------------------------------------- List -------------------------------------*/
+struct list {
+	struct list *next;
+};
+
+void
+list_init(list_t list){
+	*list = NULL;
+}
+
+void
+*list_head(list_t list){
+	return *list;
+}
+
+void
+*list_tail(list_t list){
+	struct list *l;
+
+	if(*list == NULL){
+		return NULL;
+	}
+	for(l = *list; l->next != NULL; l = l->next);
+	return l;
+}
+
+void
+list_remove(list_t list, void *item){
+	struct list **l;
+
+	for(l = (struct list **) list; *l != NULL; l = &(*l)->next){
+		if(*l == item){
+			*l = (*l)->next;
+			((struct list *) item)->next = NULL;
+			return;
+		}
+	}
+}
+
+void
+list_add(list_t list, void *item){
+	struct list *tail;
+
+	list_remove(list, item);
+	((struct list *) item)->next = NULL;
+	tail = list_tail(list);
+	if(tail == NULL){
+		*list = item;
+	} else {
+		tail->next = item;
+	}
+}
+
+void
+list_push(list_t list, void *item){
+	list_remove(list, item);
+	((struct list *) item)->next = *list;
+	*list = item;
+}
+
+int
+list_length(list_t list){
+	struct list *l;
+	int n = 0;
+
+	for(l = *list; l != NULL; l = l->next){
+		n++;
+	}
+	return n;
+}
+
+void
+*list_item_next(void *item){
+	return (item == NULL) ? NULL : ((struct list *) item)->next;
+}
+
+/*------------------------------------- Memb -------------------------------------*/
+void
+memb_init(struct memb *m){
+	memset(m->count, 0, m->num);
+	memset(m->mem, 0xa5, (size_t) m->size * m->num);
+}
+
+void
+*memb_alloc(struct memb *m){
+	int i;
+
+	for(i = 0; i < m->num; i++){
+		if(m->count[i] == 0){
+			m->count[i] = 1;
+			return (char *) m->mem + (size_t) i * m->size;
+		}
+	}
+	return NULL;
+}
+
+char
+memb_free(struct memb *m, void *ptr){
+	int i = ((char *) ptr - (char *) m->mem) / m->size;
+
+	//A bad free is a bug of the code under test
+	if(i < 0 || i >= m->num || m->count[i] == 0){
+		fprintf(stderr, "mock: bad memb_free\n");
+		abort();
+	}
+	m->count[i] = 0;
+	return 0;
+}
+
+int
+memb_numfree(struct memb *m){
+	int i;
+	int n = 0;
+
+	for(i = 0; i < m->num; i++){
+		n += (m->count[i] == 0);
+	}
+	return n;
+}
+
+/*------------------------------------- Timers -----------------------------------*/
+static struct ctimer *mock_ctimer_list;
+
+void
+ctimer_stop(struct ctimer *c){
+	list_remove((list_t) &mock_ctimer_list, c);
+	c->f = NULL;
+}
+
+void
+ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr){
+	list_remove((list_t) &mock_ctimer_list, c);
+	c->start = mock_now;
+	c->interval = t;
+	c->f = f;
+	c->ptr = ptr;
+	list_add((list_t) &mock_ctimer_list, c);
+}
+
+int
+ctimer_expired(struct ctimer *c){
+	return c->f == NULL;
+}
+
+int
+mock_ctimers(){
+	return list_length((list_t) &mock_ctimer_list);
+}
+
+/**
+ * @brief Fire the first ctimer due.
+ * @return 1 (True) if one was fired.
+ */
+static int
+ctimer_fire(){
+	struct ctimer *c;
+	void (*f)(void *);
+
+	for(c = mock_ctimer_list; c != NULL; c = c->next){
+		if(!CLOCK_LT(mock_now, (clock_time_t)(c->start + c->interval))){
+			f = c->f;
+			ctimer_stop(c);
+			f(c->ptr);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*------------------------------------- Processes --------------------------------*/
+static struct {
+	struct process *p;
+	process_event_t ev;
+	process_data_t data;
+} mock_events[MOCK_EVENTS];
+static int mock_event_count;
+
+void
+process_start(struct process *p, process_data_t data){
+	p->pt.lc = 0;
+	p->thread(&p->pt, PROCESS_EVENT_INIT, data);
+}
+
+int
+process_post(struct process *p, process_event_t ev, process_data_t data){
+	if(mock_event_count == MOCK_EVENTS){
+		return PROCESS_ERR_FULL;
+	}
+	mock_events[mock_event_count].p = p;
+	mock_events[mock_event_count].ev = ev;
+	mock_events[mock_event_count].data = data;
+	mock_event_count++;
+	return PROCESS_ERR_OK;
+}
+
+void
+process_poll(struct process *p){
+	process_post(p, PROCESS_EVENT_POLL, NULL);
+}
+
+/**
+ * @brief Deliver the events posted, in order.
+ */
+static void
+process_run(){
+	struct process *p;
+	process_event_t ev;
+	process_data_t data;
+
+	while(mock_event_count > 0){
+		p = mock_events[0].p;
+		ev = mock_events[0].ev;
+		data = mock_events[0].data;
+		mock_event_count--;
+		memmove(&mock_events[0], &mock_events[1], mock_event_count * sizeof(mock_events[0]));
+		p->thread(&p->pt, ev, data);
+	}
+}
+
+/*------------------------------------- Rime -------------------------------------*/
+rimeaddr_t rimeaddr_node_addr;
+const rimeaddr_t rimeaddr_null;
+
+void
+rimeaddr_copy(rimeaddr_t *dest, const rimeaddr_t *from){
+	memcpy(dest, from, sizeof(rimeaddr_t));
+}
+
+unsigned char
+rimeaddr_cmp(const rimeaddr_t *addr1, const rimeaddr_t *addr2){
+	return memcmp(addr1, addr2, sizeof(rimeaddr_t)) == 0;
+}
+
+static uint8_t packetbuf[PACKETBUF_HDR_SIZE + PACKETBUF_SIZE];
+static uint16_t packetbuf_len;
+static uint8_t packetbuf_hdr;
+static packetbuf_attr_t packetbuf_attrs[PACKETBUF_ATTR_NUM];
+static rimeaddr_t packetbuf_addrs[PACKETBUF_ADDR_LAST - PACKETBUF_ADDR_SENDER];
+
+void
+packetbuf_clear(void){
+	packetbuf_len = 0;
+	packetbuf_hdr = PACKETBUF_HDR_SIZE;
+	memset(packetbuf_attrs, 0, sizeof(packetbuf_attrs));
+	memset(packetbuf_addrs, 0, sizeof(packetbuf_addrs));
+}
+
+void
+*packetbuf_dataptr(void){
+	return packetbuf + PACKETBUF_HDR_SIZE;
+}
+
+void
+*packetbuf_hdrptr(void){
+	return packetbuf + packetbuf_hdr;
+}
+
+uint16_t
+packetbuf_datalen(void){
+	return packetbuf_len;
+}
+
+uint16_t
+packetbuf_totlen(void){
+	return PACKETBUF_HDR_SIZE - packetbuf_hdr + packetbuf_len;
+}
+
+void
+packetbuf_set_datalen(uint16_t len){
+	if(len > PACKETBUF_SIZE){
+		fprintf(stderr, "mock: packetbuf overflow %u\n", len);
+		abort();
+	}
+	packetbuf_len = len;
+}
+
+int
+packetbuf_copyfrom(const void *from, uint16_t len){
+	packetbuf_clear();
+	packetbuf_len = (len > PACKETBUF_SIZE) ? PACKETBUF_SIZE : len;
+	memmove(packetbuf_dataptr(), from, packetbuf_len);
+	return packetbuf_len;
+}
+
+int
+packetbuf_copyto(void *to){
+	memcpy(to, packetbuf_hdrptr(), packetbuf_totlen());
+	return packetbuf_totlen();
+}
+
+int
+packetbuf_hdralloc(int size){
+	if(packetbuf_hdr < size || packetbuf_totlen() + size > PACKETBUF_SIZE){
+		return 0;
+	}
+	packetbuf_hdr -= size;
+	return 1;
+}
+
+int
+packetbuf_set_attr(uint8_t type, const packetbuf_attr_t val){
+	packetbuf_attrs[type] = val;
+	return 1;
+}
+
+packetbuf_attr_t
+packetbuf_attr(uint8_t type){
+	return packetbuf_attrs[type];
+}
+
+int
+packetbuf_set_addr(uint8_t type, const rimeaddr_t *addr){
+	rimeaddr_copy(&packetbuf_addrs[type - PACKETBUF_ADDR_SENDER], addr);
+	return 1;
+}
+
+const rimeaddr_t
+*packetbuf_addr(uint8_t type){
+	return &packetbuf_addrs[type - PACKETBUF_ADDR_SENDER];
+}
+
+struct queuebuf {
+	uint8_t in_use;
+	uint16_t len;
+	uint8_t data[PACKETBUF_HDR_SIZE + PACKETBUF_SIZE];
+};
+static struct queuebuf mock_queuebufs[QUEUEBUF_CONF_NUM];
+
+struct queuebuf
+*queuebuf_new_from_packetbuf(void){
+	int i;
+
+	for(i = 0; i < QUEUEBUF_CONF_NUM; i++){
+		if(mock_queuebufs[i].in_use == 0){
+			mock_queuebufs[i].in_use = 1;
+			mock_queuebufs[i].len = packetbuf_copyto(mock_queuebufs[i].data);
+			return &mock_queuebufs[i];
+		}
+	}
+	return NULL;
+}
+
+void
+queuebuf_to_packetbuf(struct queuebuf *b){
+	packetbuf_copyfrom(b->data, b->len);
+}
+
+void
+queuebuf_free(struct queuebuf *b){
+	if(b->in_use == 0){
+		fprintf(stderr, "mock: queuebuf freed twice\n");
+		abort();
+	}
+	b->in_use = 0;
+}
+
+void
+*queuebuf_dataptr(struct queuebuf *b){
+	return b->data;
+}
+
+int
+queuebuf_datalen(struct queuebuf *b){
+	return b->len;
+}
+
+/**
+ * @brief Lifetimer callback of a packetqueue item.
+ */
+static void
+packetqueue_remove(void *ptr){
+	struct packetqueue_item *i = ptr;
+
+	list_remove(*i->queue->list, i);
+	queuebuf_free(i->buf);
+	ctimer_stop(&i->lifetimer);
+	memb_free(i->queue->memb, i);
+}
+
+void
+packetqueue_init(struct packetqueue *q){
+	list_init(*q->list);
+	memb_init(q->memb);
+}
+
+int
+packetqueue_enqueue_packetbuf(struct packetqueue *q, clock_time_t lifetime, void *ptr){
+	struct packetqueue_item *i = memb_alloc(q->memb);
+
+	if(i == NULL){
+		return 0;
+	}
+	i->buf = queuebuf_new_from_packetbuf();
+	if(i->buf == NULL){
+		memb_free(q->memb, i);
+		return 0;
+	}
+	i->queue = q;
+	i->ptr = ptr;
+	i->lifetimer.f = NULL;
+	i->lifetimer.next = NULL;
+	if(lifetime > 0){
+		ctimer_set(&i->lifetimer, lifetime, packetqueue_remove, i);
+	}
+	list_add(*q->list, i);
+	return 1;
+}
+
+struct packetqueue_item
+*packetqueue_first(struct packetqueue *q){
+	return list_head(*q->list);
+}
+
+void
+packetqueue_dequeue(struct packetqueue *q){
+	struct packetqueue_item *i = list_head(*q->list);
+
+	if(i != NULL){
+		packetqueue_remove(i);
+	}
+}
+
+int
+packetqueue_len(struct packetqueue *q){
+	return list_length(*q->list);
+}
+
+struct queuebuf
+*packetqueue_queuebuf(struct packetqueue_item *i){
+	return (i == NULL) ? NULL : i->buf;
+}
+
+void
+*packetqueue_ptr(struct packetqueue_item *i){
+	return (i == NULL) ? NULL : i->ptr;
+}
+
+void
+broadcast_open(struct broadcast_conn *c, uint16_t channel, const struct broadcast_callbacks *u){
+	c->channel = channel;
+	c->u = u;
+}
+
+void
+broadcast_close(struct broadcast_conn *c){
+}
+
+int
+broadcast_send(struct broadcast_conn *c){
+	mock_radio.broadcasts++;
+	mock_radio.bytes += packetbuf_totlen();
+	return 1;
+}
+
+void
+unicast_open(struct unicast_conn *c, uint16_t channel, const struct unicast_callbacks *u){
+	c->channel = channel;
+	c->u = u;
+}
+
+void
+unicast_close(struct unicast_conn *c){
+}
+
+int
+unicast_send(struct unicast_conn *c, const rimeaddr_t *receiver){
+	mock_radio.unicasts++;
+	mock_radio.bytes += packetbuf_totlen();
+	return 1;
+}
+
+static struct runicast_conn *mock_runicast_list;
+
+void
+runicast_open(struct runicast_conn *c, uint16_t channel, const struct runicast_callbacks *u){
+	c->channel = channel;
+	c->u = u;
+	c->is_tx = 0;
+}
+
+void
+runicast_close(struct runicast_conn *c){
+	list_remove((list_t) &mock_runicast_list, c);
+}
+
+int
+runicast_send(struct runicast_conn *c, const rimeaddr_t *receiver, uint8_t max_retransmissions){
+	if(c->is_tx == 1){
+		return 0;
+	}
+	c->is_tx = 1;
+	rimeaddr_copy(&c->to, receiver);
+	list_add((list_t) &mock_runicast_list, c);
+	mock_radio.runicasts++;
+	mock_radio.bytes += packetbuf_totlen();
+	return 1;
+}
+
+uint8_t
+runicast_is_transmitting(struct runicast_conn *c){
+	return c->is_tx;
+}
+
+/**
+ * @brief ACK the runicasts in flight.
+ */
+static void
+runicast_ack(){
+	struct runicast_conn *c;
+
+	while((c = list_head((list_t) &mock_runicast_list)) != NULL){
+		list_remove((list_t) &mock_runicast_list, c);
+		c->is_tx = 0;
+		c->u->sent(c, &c->to, 0);
+	}
+}
+
+/*------------------------------------- Random -----------------------------------*/
+static unsigned short mock_seed = 1;
+
+unsigned short
+random_rand(void){
+	mock_seed = mock_seed * 25173 + 13849;
+	return mock_seed;
+}
+
+void
+random_init(unsigned short seed){
+	mock_seed = seed;
+}
+
+/*------------------------------------- Energest ---------------------------------*/
+unsigned long
+energest_type_time(int type){
+	return (type == ENERGEST_TYPE_CPU) ? (unsigned long) mock_now * (RTIMER_SECOND / CLOCK_SECOND) : 0;
+}
+
+void
+energest_flush(void){
+}
+
+/*------------------------------------- CFS --------------------------------------*/
+static struct {
+	char name[16];
+	uint8_t data[MOCK_FILE_SIZE];
+	long len;
+	uint8_t in_use;
+} mock_files[MOCK_FILES];
+static struct {
+	int file;
+	long pos;
+	uint8_t in_use;
+} mock_fds[MOCK_FDS];
+
+int
+cfs_open(const char *name, int flags){
+	int f;
+	int fd;
+
+	for(f = 0; f < MOCK_FILES && (mock_files[f].in_use == 0 || strcmp(mock_files[f].name, name) != 0); f++);
+	if(f == MOCK_FILES){
+		if((flags & (CFS_WRITE | CFS_APPEND)) == 0){
+			return -1;
+		}
+		for(f = 0; f < MOCK_FILES && mock_files[f].in_use == 1; f++);
+		if(f == MOCK_FILES){
+			return -1;
+		}
+		mock_files[f].in_use = 1;
+		mock_files[f].len = 0;
+		strncpy(mock_files[f].name, name, sizeof(mock_files[f].name) - 1);
+	}
+	for(fd = 0; fd < MOCK_FDS; fd++){
+		if(mock_fds[fd].in_use == 0){
+			mock_fds[fd].in_use = 1;
+			mock_fds[fd].file = f;
+			mock_fds[fd].pos = ((flags & CFS_APPEND) != 0) ? mock_files[f].len : 0;
+			return fd;
+		}
+	}
+	return -1;
+}
+
+void
+cfs_close(int fd){
+	mock_fds[fd].in_use = 0;
+}
+
+int
+cfs_read(int fd, void *buf, unsigned int len){
+	int f = mock_fds[fd].file;
+	long n = mock_files[f].len - mock_fds[fd].pos;
+
+	n = (n < 0) ? 0 : (n > (long) len) ? (long) len : n;
+	memcpy(buf, mock_files[f].data + mock_fds[fd].pos, n);
+	mock_fds[fd].pos += n;
+	return n;
+}
+
+int
+cfs_write(int fd, const void *buf, unsigned int len){
+	int f = mock_fds[fd].file;
+
+	if(mock_fds[fd].pos + (long) len > MOCK_FILE_SIZE){
+		return -1;
+	}
+	memcpy(mock_files[f].data + mock_fds[fd].pos, buf, len);
+	mock_fds[fd].pos += len;
+	if(mock_fds[fd].pos > mock_files[f].len){
+		mock_files[f].len = mock_fds[fd].pos;
+	}
+	return len;
+}
+
+cfs_offset_t
+cfs_seek(int fd, cfs_offset_t offset, int whence){
+	int f = mock_fds[fd].file;
+
+	if(whence == CFS_SEEK_SET){
+		mock_fds[fd].pos = offset;
+	} else if(whence == CFS_SEEK_CUR){
+		mock_fds[fd].pos += offset;
+	} else {
+		mock_fds[fd].pos = mock_files[f].len + offset;
+	}
+	return mock_fds[fd].pos;
+}
+
+int
+cfs_remove(const char *name){
+	int f;
+
+	for(f = 0; f < MOCK_FILES; f++){
+		if(mock_files[f].in_use == 1 && strcmp(mock_files[f].name, name) == 0){
+			mock_files[f].in_use = 0;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int
+cfs_coffee_reserve(const char *name, cfs_offset_t size){
+	return 0;
+}
+
+/*------------------------------------- Mock control -----------------------------*/
+void
+mock_advance(clock_time_t ticks){
+	do {
+		runicast_ack();
+		process_run();
+		while(ctimer_fire() == 1){
+			runicast_ack();
+			process_run();
+		}
+		if(ticks > 0){
+			mock_now++;
+		}
+	} while(ticks-- > 0);
+}
+
+void
+mock_jump(clock_time_t ticks){
+	mock_now += ticks;
+}
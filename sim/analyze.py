@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Summarise the logs of Cooja runs of the bus application.
+
+Every log is a COOJA.testlog written by the scenarios of scenario.py: one line per mote
+output, "<time us> <mote id> <output>". One row is printed per log with:
+  delivery   Readings delivered to the destination over readings taken.
+  median     Median end to end latency of the delivered bundles, in seconds.
+  p95        95th percentile of the latency, in seconds.
+  frames     DTN frames (sprays, requests and handoffs) sent by all nodes per delivered bundle.
+  queue      Mean and max queue occupancy of the STATS reports.
+"""
+
+import argparse
+import math
+import re
+import sys
+
+DELIVER = re.compile(r"- DELIVER - .* LEN: (\d+) LATENCY: (\d+) s")
+READING = re.compile(r"READING: NODE: (\d+)")
+STATS = re.compile(r"STATS: NODE: (\d+) QUEUE: (\d+) SPRAYS: (\d+) REQUESTS: (\d+) HANDOFFS: (\d+)")
+
+
+def percentile(values, p):
+    """Nearest rank percentile."""
+    if not values:
+        return float("nan")
+    ordered = sorted(values)
+    return ordered[max(0, int(math.ceil(p / 100.0 * len(ordered))) - 1)]
+
+
+def summarise(path, reading_size):
+    readings = 0
+    delivered = 0
+    latency = []
+    frames = {}
+    queue = []
+    with open(path) as f:
+        for line in f:
+            m = DELIVER.search(line)
+            if m:
+                delivered += int(m.group(1)) // reading_size
+                latency.append(int(m.group(2)))
+                continue
+            if READING.search(line):
+                readings += 1
+                continue
+            m = STATS.search(line)
+            if m:
+                # The counters only grow, the last report of a node holds its total
+                frames[m.group(1)] = int(m.group(3)) + int(m.group(4)) + int(m.group(5))
+                queue.append(int(m.group(2)))
+    return {
+        "delivery": delivered / readings if readings else float("nan"),
+        "median": percentile(latency, 50),
+        "p95": percentile(latency, 95),
+        "frames": sum(frames.values()) / len(latency) if latency else float("nan"),
+        "queue_mean": sum(queue) / len(queue) if queue else float("nan"),
+        "queue_max": max(queue) if queue else 0,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("logs", nargs="+", metavar="name=log", help="a log, optionally named")
+    parser.add_argument("--reading-size", type=int, default=10, help="bytes of one reading of bus.c")
+    args = parser.parse_args()
+
+    print("%-32s %8s %7s %5s %7s %10s %9s" % ("run", "delivery", "median", "p95", "frames", "queue_mean", "queue_max"))
+    for arg in args.logs:
+        name, _, path = arg.rpartition("=")
+        s = summarise(path, args.reading_size)
+        print("%-32s %8.3f %7.1f %5.1f %7.1f %10.2f %9d" % (name or path, s["delivery"], s["median"], s["p95"],
+                                                             s["frames"], s["queue_mean"], s["queue_max"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,52 @@
+#!/bin/sh
+#Run the simulation suite of the bus application in Cooja and print the summary of every run.
+#Every configuration of DTN_L_COPIES, DTN_PACKET_DELAY (ms) and MAX_QUEUE_PACKETS is built once
+#and run with both mobility models for every seed. The settings below can be changed from the
+#environment, e.g. SEEDS="1" L_COPIES_SET="8" sim/run.sh
+#Needs a Contiki tree with Cooja built (ant jar in tools/cooja). As for the Makefile the
+#application is expected two levels below it, or CONTIKI is set.
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+APP=$(dirname "$HERE")
+CONTIKI=${CONTIKI:-$APP/../..}
+COOJA=$CONTIKI/tools/cooja/dist/cooja.jar
+OUT=${OUT:-$HERE/results}
+
+SOURCES=${SOURCES:-3}
+RELAYS=${RELAYS:-6}
+DURATION=${DURATION:-3600}
+TRAFFIC=${TRAFFIC:-30}
+SEEDS=${SEEDS:-"1 2 3"}
+MOBILITY_SET=${MOBILITY_SET:-"rwp bus"}
+L_COPIES_SET=${L_COPIES_SET:-"4 8 16"}
+DELAY_SET=${DELAY_SET:-"500 1000 2000"}
+QUEUE_SET=${QUEUE_SET:-"5 10 20"}
+#The destination is the last node of the scenario
+DESTINATION=$((SOURCES + RELAYS + 1))
+
+mkdir -p "$OUT"
+logs=""
+for l in $L_COPIES_SET; do
+	for d in $DELAY_SET; do
+		for q in $QUEUE_SET; do
+			config=L$l-D$d-Q$q
+			make -C "$APP" TARGET=sky clean > /dev/null
+			make -C "$APP" TARGET=sky bus.sky TRAFFIC=$TRAFFIC SOURCES=$SOURCES DESTINATION=$DESTINATION \
+				L_COPIES=$l PACKET_DELAY=$d QUEUE_PACKETS=$q > /dev/null
+			cp "$APP/bus.sky" "$OUT/$config.sky"
+			for mobility in $MOBILITY_SET; do
+				for seed in $SEEDS; do
+					run=$mobility-$config-s$seed
+					python3 "$HERE/scenario.py" --mobility $mobility --sources $SOURCES --relays $RELAYS \
+						--duration $DURATION --seed $seed --firmware "$OUT/$config.sky" --out "$OUT/$run.csc"
+					(cd "$OUT" && java -mx512m -jar "$COOJA" -nogui="$OUT/$run.csc" -contiki="$CONTIKI" > "$OUT/$run.cooja")
+					mv "$OUT/COOJA.testlog" "$OUT/$run.log"
+					logs="$logs $run=$OUT/$run.log"
+				done
+			done
+		done
+	done
+done
+
+python3 "$HERE/analyze.py" $logs | tee "$OUT/summary.txt"
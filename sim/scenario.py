@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Write a Cooja scenario of the bus application.
+
+Nodes 1 to SOURCES are static sources, the next RELAYS nodes are mobile relays and
+the last node is the destination. The relays move with one of two models:
+  rwp  Random waypoint in the whole area.
+  bus  Buses going round a closed route, one after another, stopping at every stop.
+The positions are written for the Cooja Mobility plugin next to the .csc. The same
+seed always gives the same scenario.
+"""
+
+import argparse
+import math
+import os
+import random
+
+CSC = """<?xml version="1.0" encoding="UTF-8"?>
+<simconf>
+  <project EXPORT="discard">[APPS_DIR]/mrm</project>
+  <project EXPORT="discard">[APPS_DIR]/mspsim</project>
+  <project EXPORT="discard">[APPS_DIR]/avrora</project>
+  <project EXPORT="discard">[APPS_DIR]/serial_socket</project>
+  <project EXPORT="discard">[APPS_DIR]/collect-view</project>
+  <project EXPORT="discard">[APPS_DIR]/powertracker</project>
+  <project EXPORT="discard">[APPS_DIR]/mobility</project>
+  <simulation>
+    <title>DTN bus {name}</title>
+    <randomseed>{seed}</randomseed>
+    <motedelay_us>1000000</motedelay_us>
+    <radiomedium>
+      se.sics.cooja.radiomediums.UDGM
+      <transmitting_range>{range}</transmitting_range>
+      <interference_range>{interference}</interference_range>
+      <success_ratio_tx>1.0</success_ratio_tx>
+      <success_ratio_rx>{success}</success_ratio_rx>
+    </radiomedium>
+    <events>
+      <logoutput>40000</logoutput>
+    </events>
+    <motetype>
+      se.sics.cooja.mspmote.SkyMoteType
+      <identifier>sky1</identifier>
+      <description>DTN bus</description>
+      <firmware EXPORT="copy">{firmware}</firmware>
+      <moteinterface>se.sics.cooja.interfaces.Position</moteinterface>
+      <moteinterface>se.sics.cooja.interfaces.RimeAddress</moteinterface>
+      <moteinterface>se.sics.cooja.interfaces.IPAddress</moteinterface>
+      <moteinterface>se.sics.cooja.interfaces.Mote2MoteRelations</moteinterface>
+      <moteinterface>se.sics.cooja.interfaces.MoteAttributes</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.MspClock</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.MspMoteID</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.SkyButton</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.SkyFlash</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.SkyCoffeeFilesystem</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.Msp802154Radio</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.MspSerial</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.SkyLED</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.MspDebugOutput</moteinterface>
+      <moteinterface>se.sics.cooja.mspmote.interfaces.SkyTemperature</moteinterface>
+    </motetype>
+{motes}
+  </simulation>
+  <plugin>
+    Mobility
+    <plugin_config>
+      <positions EXPORT="copy">[CONFIG_DIR]/{positions}</positions>
+    </plugin_config>
+  </plugin>
+  <plugin>
+    se.sics.cooja.plugins.ScriptRunner
+    <plugin_config>
+      <script>
+TIMEOUT({timeout_ms}, log.testOK());
+while(true) {{
+  log.log(time + " " + id + " " + msg + "\\n");
+  YIELD();
+}}
+      </script>
+      <active>true</active>
+    </plugin_config>
+  </plugin>
+</simconf>
+"""
+
+MOTE = """    <mote>
+      <breakpoints />
+      <interface_config>
+        se.sics.cooja.interfaces.Position
+        <x>{x:.1f}</x>
+        <y>{y:.1f}</y>
+        <z>0.0</z>
+      </interface_config>
+      <interface_config>
+        se.sics.cooja.mspmote.interfaces.MspMoteID
+        <id>{id}</id>
+      </interface_config>
+      <motetype_identifier>sky1</motetype_identifier>
+    </mote>"""
+
+# Seconds between two points of the mobility trace
+STEP = 1.0
+
+
+def random_waypoint(rng, area, duration, speed, pause):
+    """Positions every STEP of a node moving with the random waypoint model."""
+    x, y = rng.uniform(0, area), rng.uniform(0, area)
+    t = 0.0
+    trace = []
+    while t <= duration:
+        tx, ty = rng.uniform(0, area), rng.uniform(0, area)
+        v = rng.uniform(speed[0], speed[1])
+        steps = max(1, int(math.hypot(tx - x, ty - y) / v / STEP))
+        for s in range(steps):
+            trace.append((t, x + (tx - x) * s / steps, y + (ty - y) * s / steps))
+            t += STEP
+        x, y = tx, ty
+        for s in range(int(pause / STEP)):
+            trace.append((t, x, y))
+            t += STEP
+    return [p for p in trace if p[0] <= duration]
+
+
+def bus_route(stops, duration, speed, dwell, offset):
+    """Positions every STEP of a bus going round the stops, starting offset seconds into the loop."""
+    legs = []
+    for i, a in enumerate(stops):
+        b = stops[(i + 1) % len(stops)]
+        legs.append((a, b, math.hypot(b[0] - a[0], b[1] - a[1]) / speed))
+    loop = sum(dwell + leg[2] for leg in legs)
+    trace = []
+    t = 0.0
+    while t <= duration:
+        u = (t + offset) % loop
+        for a, b, travel in legs:
+            if u < dwell:
+                pos = a
+                break
+            u -= dwell
+            if u < travel:
+                pos = (a[0] + (b[0] - a[0]) * u / travel, a[1] + (b[1] - a[1]) * u / travel)
+                break
+            u -= travel
+        trace.append((t, pos[0], pos[1]))
+        t += STEP
+    return trace
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--mobility", choices=("rwp", "bus"), default="rwp")
+    parser.add_argument("--sources", type=int, default=3)
+    parser.add_argument("--relays", type=int, default=6)
+    parser.add_argument("--area", type=float, default=400.0, help="side of the square area in metres")
+    parser.add_argument("--range", type=float, default=50.0, help="radio range in metres")
+    parser.add_argument("--success", type=float, default=0.9, help="reception ratio inside the range")
+    parser.add_argument("--duration", type=int, default=3600, help="simulated seconds")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--firmware", default="[CONFIG_DIR]/../bus.sky")
+    parser.add_argument("--out", required=True, help="the .csc to write")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    area = args.area
+    nodes = args.sources + args.relays + 1
+    # Static sources on one side, the destination on the other
+    static = {}
+    for i in range(args.sources):
+        static[i + 1] = (area * 0.1, area * (i + 1) / (args.sources + 1))
+    static[nodes] = (area * 0.9, area * 0.5)
+    # The bus stops are the sources, the destination and the corners between them
+    stops = [static[i + 1] for i in range(args.sources)]
+    stops += [(area * 0.5, area * 0.9), static[nodes], (area * 0.5, area * 0.1)]
+
+    positions = []
+    first = {}
+    for n in range(args.sources + 1, nodes):
+        if args.mobility == "rwp":
+            trace = random_waypoint(rng, area, args.duration, (1.0, 10.0), 30.0)
+        else:
+            trace = bus_route(stops, args.duration, 8.0, 20.0, (n - args.sources - 1) * args.duration / args.relays / 4)
+        first[n] = trace[0][1:]
+        # The Mobility plugin takes 0 based mote indexes
+        positions += ["%d %.1f %.1f %.1f" % (n - 1, t, x, y) for t, x, y in trace]
+
+    motes = []
+    for n in range(1, nodes + 1):
+        x, y = static.get(n, first.get(n))
+        motes.append(MOTE.format(id=n, x=x, y=y))
+
+    base = os.path.splitext(args.out)[0]
+    name = os.path.basename(base)
+    with open(base + ".dat", "w") as f:
+        f.write("\n".join(positions) + "\n")
+    with open(args.out, "w") as f:
+        f.write(CSC.format(name=name, seed=args.seed, range=args.range, interference=2 * args.range,
+                           success=args.success, firmware=args.firmware, motes="\n".join(motes),
+                           positions=name + ".dat", timeout_ms=args.duration * 1000))
+
+
+if __name__ == "__main__":
+    main()